@@ -25,34 +25,83 @@
  *	command interface
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE		/* posix_spawn_file_actions_addclosefrom_np() */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <signal.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <poll.h>
+#include <termios.h>
+#include <spawn.h>
+#include <time.h>
 #include <errno.h>
+#ifdef __linux__
+#include <sys/syscall.h>	/* SYS_close_range */
+#endif
 
 #include "conf.h"
 #include "mlpx.h"
 #include "data.h"
 #include "tesc.h"
 #include "cmdi.h"
+#include "filt.h"
+#include "resv.h"
+#include "proc.h"
+#include "fwat.h"
+#include "logw.h"
 #include "util.h"
 
 
+#define TOKSEP " \t"		/* command input token seperator */
+
+/* posix_spawn() can close all fds of the new process */
+#if defined(__GLIBC__) && \
+	(__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+#define POPEN_SPAWN
+#endif
+
+#define CMD_REPLY_MAX	1024	/* max length of a reply line */
+#define CMD_TAGMAX	64	/* max length of a request tag */
+#define POPEN_OP(rid)	((rid) == CHN_CMD ? "open" : "pool")
+#define BULK_FAILMAX	512	/* max length of a failed list */
+#define LSN_BATCH	32	/* max # of accepts per poll() */
+#define AO_DELAY	20	/* ms, first retry after a change */
+#define AO_TRIES	8	/* max # of attempts per change */
+
+
+extern char **environ;
+
 static int cmdi_open (int, char **);
 static int cmdi_close (int, char **);
+static int cmdi_define (int, char **);
+static int cmdi_undefine (int, char **);
+static int cmdi_send (int, char **);
+static int cmdi_link (int, char **);
+static int cmdi_unlink (int, char **);
+static int cmdi_stat (int, char **);
 static int cmdi_quit (int, char **);
+static void open_report (chn_t *, int);
+static void oto_start (chn_t *);
+static void oto_cancel (chn_t *);
+static void ao_arm (chn_t *);
+static void ao_cancel (chn_t *);
 
 
 /* type for command functions */
@@ -65,12 +114,65 @@ static struct {
 } cmd_commands[] = {
 	{ "open", cmdi_open },
 	{ "close", cmdi_close },
+	{ "define", cmdi_define },
+	{ "undefine", cmdi_undefine },
+	{ "send", cmdi_send },
+	{ "link", cmdi_link },
+	{ "unlink", cmdi_unlink },
+	{ "stat", cmdi_stat },
 	{ "quit", cmdi_quit },
 	{ 0, 0 }
 };
 
 
 static msg_t *cmd_input = 0;		/* cmd input queue	*/
+static const char *cmd_args = 0;	/* untokenized args	*/
+static const char *cmd_tag = 0;		/* request tag (or 0)	*/
+
+
+/*
+ *	cmdi_reply()		[private]
+ *
+ *	output a reply line on the command channel,
+ *	prefixed with the request tag 'tag' (if not 0)
+ */
+static void cmdi_reply (const char *tag, const char *fmt, ...)
+{
+va_list ap;
+char buf[CMD_REPLY_MAX];
+
+    va_start(ap, fmt);
+    if (vsnprintf (buf, sizeof(buf), fmt, ap) >= (int) sizeof(buf))
+	buf[sizeof(buf) - 2] = '\n';	/* cut, but keep the line end */
+    va_end(ap);
+
+    if (tag)
+	mlpx_printf (CHN_CMD, 0, "%s %s", tag, buf);
+    else
+	mlpx_printf (CHN_CMD, 0, "%s", buf);
+
+    return;
+}
+
+
+/*
+ *	tag_dup()		[private]
+ *
+ *	return a copy of the request tag of the current
+ *	command (for async replies), 0 if there is none
+ */
+static char *tag_dup (void)
+{
+char *t;
+
+    if (! cmd_tag)
+	return 0;
+
+    t = sec_malloc (strlen (cmd_tag) + 1);		/* may exit */
+    strcpy (t, cmd_tag);
+
+    return t;
+}
 
 /*
  *	cmdi_enque()
@@ -118,6 +220,78 @@ struct ornli *new;
 }
 
 
+/*
+ *	so_set()		[private]
+ *
+ *	set an int socket option, errors are reported only
+ */
+static void so_set (const chn_t *ch, int fd, int lvl, int opt, int val,
+							const char *name)
+{
+    if (setsockopt (fd, lvl, opt, &val, sizeof val) == -1)
+	mlpx_printf (CHN_MSG, MF_ERR, "channel %0*X: set %s: %s\n",
+				mlpx_idlen(), ch->id, name, strerror(errno));
+
+    return;
+}
+
+
+/*
+ *	sock_tune()		[private]
+ *
+ *	apply the configured socket options of 'ch' to 'fd',
+ *	the TCP ones only if 'tcp' is set. options the system
+ *	does not know are skipped.
+ */
+static void sock_tune (const chn_t *ch, int fd, int tcp)
+{
+const struct sockopt *so = ch->cf->sockopt;
+
+    if (! so)
+	return;
+
+    if (so->rcvbuf)
+	so_set (ch, fd, SOL_SOCKET, SO_RCVBUF, so->rcvbuf, "SO_RCVBUF");
+    if (so->sndbuf)
+	so_set (ch, fd, SOL_SOCKET, SO_SNDBUF, so->sndbuf, "SO_SNDBUF");
+#ifdef SO_BUSY_POLL
+    if (so->busypoll)
+	so_set (ch, fd, SOL_SOCKET, SO_BUSY_POLL, so->busypoll,
+							"SO_BUSY_POLL");
+#endif
+
+    if (! tcp)
+	return;
+
+    if (so->nodelay)
+	so_set (ch, fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+
+    if (so->keepidle || so->keepintvl || so->keepcnt)
+	so_set (ch, fd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+#ifdef TCP_KEEPIDLE
+    if (so->keepidle)
+	so_set (ch, fd, IPPROTO_TCP, TCP_KEEPIDLE, so->keepidle,
+							"TCP_KEEPIDLE");
+#endif
+#ifdef TCP_KEEPINTVL
+    if (so->keepintvl)
+	so_set (ch, fd, IPPROTO_TCP, TCP_KEEPINTVL, so->keepintvl,
+							"TCP_KEEPINTVL");
+#endif
+#ifdef TCP_KEEPCNT
+    if (so->keepcnt)
+	so_set (ch, fd, IPPROTO_TCP, TCP_KEEPCNT, so->keepcnt, "TCP_KEEPCNT");
+#endif
+#ifdef TCP_USER_TIMEOUT
+    if (so->usertimeout)
+	so_set (ch, fd, IPPROTO_TCP, TCP_USER_TIMEOUT, so->usertimeout,
+							"TCP_USER_TIMEOUT");
+#endif
+
+    return;
+}
+
+
 /*
  *	cmdi_open_UNIX()	[private]
  *
@@ -130,6 +304,15 @@ static int cmdi_open_UNIX (chn_t *ch)
 size_t l;
 struct sockaddr_un a;
 int on = 1;
+int type = SOCK_STREAM;
+#ifdef __linux__
+struct sockaddr_un ab;
+#endif
+
+    if (ch->cf->method.data & MT_F_DGRAM)
+	type = SOCK_DGRAM;
+    else if (ch->cf->method.data & MT_F_SEQPKT)
+	type = SOCK_SEQPACKET;
 
     if ((l = strlen (ch->cf->method.str)) > sizeof(a.sun_path)) {
 	mlpx_printf (CHN_MSG, MF_ERR, "socket path to long (%d)\n", l);
@@ -143,7 +326,7 @@ int on = 1;
     strncpy (a.sun_path, ch->cf->method.str, sizeof(a.sun_path));
 
     /* open up the connection */
-    if ((ch->fd = socket (AF_LOCAL, SOCK_STREAM, 0)) == -1) {
+    if ((ch->fd = socket (AF_LOCAL, type, 0)) == -1) {
 	mlpx_printf (CHN_MSG, MF_ERR, "socket(): %s\n", strerror(errno));
 	return -1;
     }
@@ -154,6 +337,20 @@ int on = 1;
 	ch->fd = -1;
 	return -1;
     }
+    sock_tune (ch, ch->fd, 0);
+#ifdef __linux__
+    /* autobind, so the peer has an address to answer to */
+    if (type == SOCK_DGRAM) {
+	memset (&ab, 0, sizeof ab);
+	ab.sun_family = AF_UNIX;
+	if (bind (ch->fd, (struct sockaddr *)&ab, sizeof(sa_family_t)) == -1) {
+	    mlpx_printf (CHN_MSG, MF_ERR, "bind(): %s\n", strerror(errno));
+	    (void) close (ch->fd);
+	    ch->fd = -1;
+	    return -1;
+	}
+    }
+#endif
     if (connect (ch->fd, (struct sockaddr *)&a, sizeof a) == -1) {
 	if (errno == EINPROGRESS) {
 	    ch->flags |= CHN_F_RD | CHN_F_WR | CHN_F_CIP;
@@ -177,65 +374,93 @@ int on = 1;
 
 
 /*
- *	cmdi_open_INET()	[private]
+ *	open of inet channels
  *
- *	inet (v4)  socket access
+ *	the host may resolve to several addresses (IPv4 and IPv6).
+ *	they are tried in parallel, staggered by HE_DELAY ms (like
+ *	"happy eyeballs", RFC 8305), alternating the address families.
+ *	each connect in progress has its own (attempt) chn_t, which is
+ *	not in chmap. the first one to connect wins, the fd is moved
+ *	to the actual channel, the other attempts are closed.
+ */
+
+#define HE_DELAY	250		/* ms until next attempt	*/
+#define HE_MAXADDR	8		/* max # of addresses to try	*/
+
+struct inetop {
+	chn_t			*ch;		/* channel being opened	*/
+	struct sockaddr_storage	addr[HE_MAXADDR];
+	socklen_t		alen[HE_MAXADDR];
+	int			naddr;		/* # of addresses	*/
+	int			next;		/* next one to try	*/
+	chn_t			*att[HE_MAXADDR]; /* attempts in prog.	*/
+	int			natt;
+	timedev_t		te;		/* start next attempt	*/
+	int			tepend;		/* 'te' is scheduled	*/
+};
+
+
+/*
+ *	orn_purge()		[private]
  *
- *	return value like cmdi_open()
+ *	remove pending notifications for 'ch'
  */
-static int cmdi_open_INET (chn_t *ch)
+static void orn_purge (const chn_t *ch)
 {
-struct sockaddr_in a;
-int on = 1;
+struct ornli **op, *tmp;
 
-    /* fill in sockaddr_in with required params */
-    switch (inet_pton (AF_INET, ch->cf->method.str, &a.sin_addr)) {
-	case -1 :
-	    mlpx_printf (CHN_CMD, MF_ERR, "open %02X: %s\n",
-						ch->id, strerror(errno));
-	    return -1;
+    for (op = &orn_list; *op; /**/)
+	if ((*op)->orn.ch == ch) {
+	    tmp = *op;
+	    *op = tmp->next;
+	    free (tmp);
+	} else
+	    op = &(*op)->next;
 
-	case 0 :
-	    mlpx_printf (CHN_CMD, MF_ERR, "open %02X: config error - "
-						"invalid address\n", ch->id);
-	    return -1;
+    return;
+}
 
-	case 1 :
-	    break;
 
-	default :
-	    mlpx_printf (CHN_CMD, MF_ERR,
-				"open %02X: internal error\n", ch->id);
-	    return -1;
-    }
-    a.sin_family = AF_INET;
-    a.sin_port = htons(ch->cf->method.data);
+/*
+ *	inet_connect()		[private]
+ *
+ *	connect 'ch' to 'a' (nonblocking)
+ *
+ *	returns: 0 connected, -1 error, -2 in progress
+ */
+static int inet_connect (chn_t *ch, const struct sockaddr *a, socklen_t al)
+{
+int on = 1;
 
     /* open up the connection */
-    if ((ch->fd = socket (AF_INET, SOCK_STREAM, 0)) == -1) {
-	mlpx_printf (CHN_CMD, MF_ERR, "open %02X: socket(): %s\n",
-						ch->id, strerror(errno));
+    if ((ch->fd = socket (a->sa_family, ch->cf->method.type == mtUDP ?
+					SOCK_DGRAM : SOCK_STREAM, 0)) == -1) {
+	mlpx_printf (CHN_CMD, MF_ERR, "open %0*X: socket(): %s\n",
+					mlpx_idlen(), ch->id, strerror(errno));
 	return -1;
     }
 
     /* make it nonblocking */
     if (ioctl (ch->fd, FIONBIO, &on) == -1) {
-	mlpx_printf (CHN_CMD, MF_ERR, "open %02X: set FIONBIO: %s\n",
-						ch->id, strerror(errno));
+	mlpx_printf (CHN_CMD, MF_ERR, "open %0*X: set FIONBIO: %s\n",
+					mlpx_idlen(), ch->id, strerror(errno));
 	(void) close (ch->fd);
 	ch->fd = -1;
 	return -1;
     }
 
+    /* before connect(), so the buffer sizes apply to the handshake */
+    sock_tune (ch, ch->fd, ch->cf->method.type == mtINET);
+
     /* try to establish connection */
-    if (connect (ch->fd, (struct sockaddr *)&a, sizeof a) == -1) {
+    if (connect (ch->fd, a, al) == -1) {
 	if (errno == EINPROGRESS) {
 	    ch->flags |= CHN_F_RD | CHN_F_WR | CHN_F_CIP;
 	    return -2;	/* cannot complete immediately */
 	}
 
-	mlpx_printf (CHN_CMD, MF_ERR, "open %02X: connect(): %s\n",
-						ch->id, strerror(errno));
+	mlpx_printf (CHN_CMD, MF_ERR, "open %0*X: connect(): %s\n",
+					mlpx_idlen(), ch->id, strerror(errno));
 	(void) close (ch->fd);
 	ch->fd = -1;
 	return -1;
@@ -244,159 +469,2188 @@ int on = 1;
     /* mark channel open R/W */
     ch->flags = CHN_F_RD | CHN_F_WR;
 
+    return 0;
+}
+
+
+/*
+ *	he_drop()		[private]
+ *
+ *	remove attempt 'i' (close its fd, unless 'keepfd')
+ */
+static void he_drop (struct inetop *op, int i, int keepfd)
+{
+chn_t *att = op->att[i];
+
+    (void) tesc_del_wq (att);		/* deletes fdio */
+    if (! keepfd)
+	(void) close (att->fd);
+    orn_purge (att);
+    free (att);
+
+    op->att[i] = op->att[--op->natt];
+
+    return;
+}
+
+
+/*
+ *	he_free()		[private]
+ *
+ *	close all attempts, free open data
+ */
+static void he_free (struct inetop *op)
+{
+    while (op->natt)
+	he_drop (op, 0, 0);
+
+    if (op->tepend)
+	(void) tesc_untimedev (&op->te);
+
+    op->ch->iop = 0;
+    op->ch->flags &= ~CHN_F_ATT;
+    free (op);
+
+    return;
+}
+
+
+/*
+ *	he_win()		[private]
+ *
+ *	connected via 'fd', finish the channel setup
+ */
+static void he_win (struct inetop *op, int fd)
+{
+chn_t *ch = op->ch;
+
+    he_free (op);
+
+    ch->fd = fd;
+    ch->flags = CHN_F_RD | CHN_F_WR;
+
     /* buffers, logfile, motd */
     mlpx_setup_ch (ch);
 
+    return;
+}
+
+
+static void he_timed (timedev_t *);
+
+/*
+ *	he_next()		[private]
+ *
+ *	start the next attempt(s)
+ *
+ *	return value like cmdi_open()
+ */
+static int he_next (struct inetop *op)
+{
+chn_t *att;
+int i, fd;
+
+    while (op->next < op->naddr) {
+	i = op->next++;
+
+	att = sec_malloc (sizeof(chn_t));		/* may exit */
+	mlpx_init_chn (att, op->ch->id, op->ch->cf);
+	att->iop = op;
+
+	switch (inet_connect (att, (struct sockaddr *) &op->addr[i],
+							op->alen[i])) {
+	    case 0 :
+		fd = att->fd;
+		free (att);
+		he_win (op, fd);
+		return 0;
+
+	    case -2 :
+		op->att[op->natt++] = att;
+		tesc_enq_wq (att, 0);	/* noticed by the scheduler */
+		tesc_keep (att);
+
+		if (op->next < op->naddr && ! op->tepend) {
+		    op->te.inms = HE_DELAY;
+		    op->te.func = he_timed;
+		    op->te.data = op;
+		    if (! tesc_timedev (&op->te))
+			op->tepend = 1;
+		}
+		return -2;
+
+	    default :
+		free (att);
+		break;		/* try next address right away */
+	}
+    }
+
+    if (op->natt)
+	return -2;	/* still waiting for some */
+
+    /* all failed */
+    he_free (op);
+
+    return -1;
+}
+
+
+/*
+ *	he_timed()		[private, used for tesc_timedev()]
+ *
+ *	no attempt finished within HE_DELAY, start the next one
+ */
+static void he_timed (timedev_t *te)
+{
+struct inetop *op = te->data;
+chn_t *ch = op->ch;
+
+    op->tepend = 0;
+    open_report (ch, he_next (op));
+
+    return;
+}
+
+
+/*
+ *	he_notify()		[private]
+ *
+ *	result for connect attempt 'att' (from cmdi_handle_cip())
+ *
+ *	return value like cmdi_open()
+ */
+static int he_notify (chn_t *att, int res)
+{
+struct inetop *op = att->iop;
+int i, fd;
+
+    for (i = 0; i < op->natt; ++i)
+	if (op->att[i] == att)
+	    break;
+
+    if (!res) {
+	/* connected, take the fd */
+	fd = att->fd;
+	he_drop (op, i, 1);
+	he_win (op, fd);
+	return 0;
+    }
+
+    he_drop (op, i, 0);
+
+    /* do not wait for the timer if nothing else is in progress */
+    if (! op->natt && op->tepend) {
+	(void) tesc_untimedev (&op->te);
+	op->tepend = 0;
+    }
+    if (op->natt)
+	return -2;
+
+    return he_next (op);
+}
+
+
+/*
+ *	he_start()		[private]
+ *
+ *	open inet channel 'ch' using the addresses in 'ai'
+ *
+ *	return value like cmdi_open()
+ */
+static int he_start (chn_t *ch, const struct addrinfo *ai)
+{
+struct inetop *op;
+const struct addrinfo *cur[2];
+int i, f, port;
+
+    op = sec_malloc (sizeof(struct inetop));		/* may exit */
+    op->ch = ch;
+    op->naddr = 0;
+    op->next = 0;
+    op->natt = 0;
+    op->tepend = 0;
+
+    /* alternate address families, starting with the first one */
+    cur[0] = ai;
+    for (cur[1] = ai; cur[1] && cur[1]->ai_family == ai->ai_family;
+							cur[1] = cur[1]->ai_next)
+	;
+    port = htons(ch->cf->method.data);
+    for (f = 0; (cur[0] || cur[1]) && op->naddr < HE_MAXADDR; f = !f) {
+	if (! cur[f])
+	    continue;
+
+	i = op->naddr;
+	if (cur[f]->ai_family == AF_INET6 || cur[f]->ai_family == AF_INET) {
+	    memcpy (&op->addr[i], cur[f]->ai_addr, cur[f]->ai_addrlen);
+	    op->alen[i] = cur[f]->ai_addrlen;
+	    if (cur[f]->ai_family == AF_INET6)
+		((struct sockaddr_in6 *) &op->addr[i])->sin6_port = port;
+	    else
+		((struct sockaddr_in *) &op->addr[i])->sin_port = port;
+	    ++op->naddr;
+	}
+
+	/* advance to the next address of the same family */
+	for (cur[f] = cur[f]->ai_next;
+		cur[f] && (cur[f]->ai_family == ai->ai_family) != !f;
+							cur[f] = cur[f]->ai_next)
+	    ;
+    }
+
+    if (! op->naddr) {
+	mlpx_printf (CHN_CMD, MF_ERR, "open %0*X: %s: no usable address\n",
+				mlpx_idlen(), ch->id, ch->cf->method.str);
+	free (op);
+	return -1;
+    }
+
+    ch->iop = op;
+    ch->flags |= CHN_F_ATT;
+
+    return he_next (op);
+}
+
+
+/*
+ *	inet_resolved()		[private, used for resv_lookup()]
+ *
+ *	host name for inet channel 'data' is resolved,
+ *	continue with the open
+ */
+static void inet_resolved (const struct addrinfo *ai, int err, void *data)
+{
+chn_t *ch = data;
+
+    if (! (ch->flags & CHN_F_RES))
+	return;		/* closed in the meantime */
+    ch->flags &= ~CHN_F_RES;
+
+    if (! ai) {
+	mlpx_printf (CHN_CMD, MF_ERR, "open %0*X: %s: %s\n",
+			mlpx_idlen(), ch->id, ch->cf->method.str,
+							gai_strerror (err));
+	open_report (ch, -1);
+	return;
+    }
+
+    open_report (ch, he_start (ch, ai));
+
+    return;
+}
+
+
+/*
+ *	cmdi_open_INET()	[private]
+ *
+ *	inet (v4/v6) socket access, host names are resolved
+ *	asynchronously (see resv.c)
+ *
+ *	return value like cmdi_open()
+ */
+static int cmdi_open_INET (chn_t *ch)
+{
+struct addrinfo hints, *nai;
+const struct addrinfo *ai;
+int r, err;
+
+    /* numeric addresses can be converted right away */
+    memset (&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = ch->cf->method.type == mtUDP ?
+					SOCK_DGRAM : SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST;
+    if (getaddrinfo (ch->cf->method.str, 0, &hints, &nai) == 0) {
+	r = he_start (ch, nai);
+	freeaddrinfo (nai);
+	return r;
+    }
+
+    /* not an address, try to resolve it */
+    r = resv_lookup (ch->cf->method.str, &ai, &err, inet_resolved, ch);
+    if (r == -2) {
+	ch->flags |= CHN_F_RES;
+	return -2;	/* cannot complete immediately */
+    } else if (r == -1) {
+	mlpx_printf (CHN_CMD, MF_ERR, "open %0*X: %s: %s\n",
+			mlpx_idlen(), ch->id, ch->cf->method.str,
+							gai_strerror (err));
+	return -1;
+    }
+
+    return he_start (ch, ai);
+}
+
+
+/*
+ *	lsn_accept()		[private, reader of listening channels]
+ *
+ *	accept pending connections (up to LSN_BATCH at once),
+ *	each one becomes a new channel, announced on CHN_CMD
+ *
+ *	returns 0 (errors are reported, but the channel stays open)
+ */
+static int lsn_accept (int fd, buf_t *b, chn_t *ch)
+{
+struct sockaddr_storage sa;
+socklen_t sl;
+char host[NI_MAXHOST], serv[NI_MAXSERV];
+chn_t *nc;
+int i, afd;
+#ifndef __linux__
+int on = 1;
+#endif
+(void) b;	/* no input buffer */
+
+    for (i = 0; i < LSN_BATCH; ++i) {
+	sl = sizeof sa;
+#ifdef __linux__
+	if ((afd = accept4 (fd, (struct sockaddr *)&sa, &sl,
+						SOCK_NONBLOCK)) == -1) {
+#else
+	if ((afd = accept (fd, (struct sockaddr *)&sa, &sl)) == -1) {
+#endif
+	    if (errno == ECONNABORTED || errno == EINTR)
+		continue;
+	    if (errno != EAGAIN && errno != EWOULDBLOCK)
+		mlpx_printf (CHN_MSG, MF_ERR, "accept on %0*X: %s\n",
+					mlpx_idlen(), ch->id, strerror(errno));
+	    break;
+	}
+
+#ifndef __linux__
+	if (ioctl (afd, FIONBIO, &on) == -1) {
+	    mlpx_printf (CHN_MSG, MF_ERR, "set FIONBIO: %s\n", strerror(errno));
+	    (void) close (afd);
+	    continue;
+	}
+#endif
+
+	if (! (nc = mlpx_new_chn (ch->cf))) {
+	    (void) close (afd);		/* no id left, turn it away */
+	    continue;
+	}
+	nc->lsn = ch;
+	++ch->nacc;
+
+	sock_tune (nc, afd, sa.ss_family != AF_UNIX);
+
+	if (sa.ss_family == AF_UNIX || getnameinfo ((struct sockaddr *)&sa,
+			sl, host, sizeof host, serv, sizeof serv,
+			NI_NUMERICHOST | NI_NUMERICSERV))
+	    mlpx_printf (CHN_CMD, 0, "ACCEPT %0*X %0*X\n", mlpx_idlen(),
+					nc->id, mlpx_idlen(), ch->id);
+	else
+	    mlpx_printf (CHN_CMD, 0, "ACCEPT %0*X %0*X %s %s\n",
+		mlpx_idlen(), nc->id, mlpx_idlen(), ch->id, host, serv);
+
+	/* mark channel open R/W */
+	nc->fd = afd;
+	nc->flags = CHN_F_RD | CHN_F_WR;
+
+	/* buffers, logfile, motd */
+	mlpx_setup_ch (nc);
+    }
+
     return 0;
 }
 
 
 /*
- *	popen_child_setup()	[private]
+ *	lsn_stale()		[private]
+ *
+ *	check whether nobody listens on the unix socket 'a' any
+ *	more (i.e., a connect() to it is refused)
+ *
+ *	returns 1 if so, 0 if not (errno set, EADDRINUSE if the
+ *	socket may still be in use)
+ */
+static int lsn_stale (const struct sockaddr_un *a)
+{
+int fd, e, r = 0, on = 1;
+
+    if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) == -1)
+	return 0;
+
+    /* non-blocking: a full backlog must not stall us */
+    if (ioctl (fd, FIONBIO, &on) == -1)
+	e = errno;
+    else if (connect (fd, (const struct sockaddr *)a, sizeof *a) == -1
+						&& errno == ECONNREFUSED)
+	r = 1;
+    else
+	e = EADDRINUSE;
+    (void) close (fd);
+
+    if (! r)
+	errno = e;
+    return r;
+}
+
+
+/*
+ *	cmdi_open_LISTEN()	[private]
+ *
+ *	listening unix / inet (v4/v6) socket, the address of
+ *	inet sockets must be numeric ("*" or "" for any).
+ *	accepted connections become channels of their own
+ *	(see lsn_accept())
+ *
+ *	return value like cmdi_open()
+ */
+static int cmdi_open_LISTEN (chn_t *ch)
+{
+struct sockaddr_un a;
+struct addrinfo hints, *ai = 0;
+const struct sockaddr *sa;
+socklen_t sl;
+struct stat st;
+const char *host, *op = 0;
+char port[16];
+size_t l;
+int fd, r, on = 1;
+
+    if (ch->cf->method.type == mtLUNIX) {
+	if ((l = strlen (ch->cf->method.str)) >= sizeof(a.sun_path)) {
+	    mlpx_printf (CHN_MSG, MF_ERR, "socket path to long (%d)\n", l);
+	    return -1;
+	}
+
+	memset (&a, 0, sizeof a);
+#ifndef __linux__
+	a.sun_len = l;
+#endif
+	a.sun_family = AF_UNIX;
+	strncpy (a.sun_path, ch->cf->method.str, sizeof(a.sun_path));
+
+	/* remove a stale socket (refusing connects), keep a live one */
+	if (lstat (a.sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+	    if (! lsn_stale (&a)) {
+		mlpx_printf (CHN_MSG, MF_ERR, "listen %s: %s\n",
+				ch->cf->method.str, strerror(errno));
+		return -1;
+	    }
+	    (void) unlink (a.sun_path);
+	}
+
+	sa = (struct sockaddr *)&a;
+	sl = sizeof a;
+    } else {
+	memset (&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+
+	host = ch->cf->method.str;
+	if (! *host || ! strcmp (host, "*"))
+	    host = 0;		/* any address */
+	snprintf (port, sizeof port, "%d", ch->cf->method.data);
+
+	if ((r = getaddrinfo (host, port, &hints, &ai))) {
+	    mlpx_printf (CHN_MSG, MF_ERR, "listen %s: %s\n",
+				ch->cf->method.str, gai_strerror (r));
+	    return -1;
+	}
+	sa = ai->ai_addr;
+	sl = ai->ai_addrlen;
+    }
+
+    if ((fd = socket (sa->sa_family, SOCK_STREAM, 0)) == -1)
+	op = "socket()";
+    else if (ioctl (fd, FIONBIO, &on) == -1)
+	op = "set FIONBIO";
+    else if (sa->sa_family != AF_UNIX && setsockopt (fd, SOL_SOCKET,
+				SO_REUSEADDR, &on, sizeof on) == -1)
+	op = "set SO_REUSEADDR";
+    else if (bind (fd, sa, sl) == -1)
+	op = "bind()";
+    else {
+	/* buffer sizes are inherited by accepted sockets */
+	sock_tune (ch, fd, 0);
+	if (listen (fd, SOMAXCONN) == -1)
+	    op = "listen()";
+    }
+
+    if (op) {
+	r = errno;
+	mlpx_printf (CHN_MSG, MF_ERR, "%s: %s\n", op, strerror(r));
+	if (fd != -1)
+	    (void) close (fd);
+    }
+    if (ai)
+	freeaddrinfo (ai);
+    if (op)
+	return -1;
+
+    /* open for reading (i.e., accepting) only */
+    ch->fd = fd;
+    ch->flags = CHN_F_RD;
+
+    tesc_add_reader (ch, lsn_accept, 0);
+
+    return 0;
+}
+
+
+/*
+ *	split_cmd()		[private]
+ *
+ *	split the command string 's' at white space into an
+ *	argv style array (allocated as a single block)
+ *
+ *	returns the array, 0 if 's' contains no words
+ */
+static char **split_cmd (const char *s)
+{
+int i, n;
+const char *p;
+char *buf;
+char **av;
+
+    /* count words */
+    for (n = 0, p = s + strspn (s, TOKSEP); *p; ++n) {
+	p += strcspn (p, TOKSEP);
+	p += strspn (p, TOKSEP);
+    }
+    if (! n)
+	return 0;
+
+    av = sec_malloc ((n + 1) * sizeof(char*) + strlen (s) + 1);	/* may exit */
+    buf = (char*) (av + n + 1);
+    strcpy (buf, s);
+
+    for (i = 0, p = strtok (buf, TOKSEP); p; p = strtok (0, TOKSEP))
+	av[i++] = (char*) p;
+    av[i] = 0;
+
+    return av;
+}
+
+
+#ifdef POPEN_SPAWN
+/*
+ *	popen_spawn()		[private]
+ *
+ *	start the process for 'ch' with posix_spawn(), 'fd' (or
+ *	the terminal 'tty' as controlling terminal of a new
+ *	session) is its stdin/stdout/stderr, all other fds
+ *	are closed
+ *
+ *	returns the pid, -1 on failure (outputs error msg
+ *	on channel 'rid')
+ */
+static pid_t popen_spawn (chn_t *ch, int rid, int fd, const char *tty,
+								char *av[])
+{
+int i, e;
+short fl;
+pid_t pid;
+sigset_t sd;
+posix_spawn_file_actions_t fa;
+posix_spawnattr_t at;
+
+    if ((e = posix_spawn_file_actions_init (&fa))) {
+	mlpx_printf (rid, MF_ERR, "%s %0*X: posix_spawn(): %s\n",
+			POPEN_OP(rid), mlpx_idlen(), ch->id, strerror(e));
+	return -1;
+    }
+    if ((e = posix_spawnattr_init (&at))) {
+	mlpx_printf (rid, MF_ERR, "%s %0*X: posix_spawn(): %s\n",
+			POPEN_OP(rid), mlpx_idlen(), ch->id, strerror(e));
+	posix_spawn_file_actions_destroy (&fa);
+	return -1;
+    }
+
+    /* setup stdin/stdout/stderr, close everything else */
+    fl = POSIX_SPAWN_SETSIGDEF;
+    if (tty) {
+	e = posix_spawn_file_actions_addopen (&fa, 0, tty, O_RDWR, 0);
+	for (i = 1; i < 3 && ! e; ++i)
+	    e = posix_spawn_file_actions_adddup2 (&fa, 0, i);
+#ifdef POSIX_SPAWN_SETSID
+	fl |= POSIX_SPAWN_SETSID;
+#endif
+    } else
+	for (i = 0; i < 3 && ! e; ++i)
+	    e = posix_spawn_file_actions_adddup2 (&fa, fd, i);
+    if (! e)
+	e = posix_spawn_file_actions_addclosefrom_np (&fa, 3);
+
+    /* ut ignores SIGPIPE, the process should not */
+    sigemptyset (&sd);
+    sigaddset (&sd, SIGPIPE);
+    if (! e)
+	e = posix_spawnattr_setsigdefault (&at, &sd);
+    if (! e)
+	e = posix_spawnattr_setflags (&at, fl);
+
+    if (! e) {
+	if (ch->cf->method.data & MT_F_EXEC)
+	    e = posix_spawnp (&pid, av[0], &fa, &at, av, environ);
+	else
+	    e = posix_spawn (&pid, "/bin/sh", &fa, &at, av, environ);
+    }
+
+    posix_spawnattr_destroy (&at);
+    posix_spawn_file_actions_destroy (&fa);
+
+    if (e) {
+	mlpx_printf (rid, MF_ERR, "%s %0*X: posix_spawn(): %s: %s\n",
+		POPEN_OP(rid), mlpx_idlen(), ch->id, av[0], strerror(e));
+	return -1;
+    }
+
+    return pid;
+}
+
+
+#else
+/*
+ *	popen_child_setup()	[private]
+ *
+ *	setup 'fd' (or the terminal 'tty' as controlling
+ *	terminal of a new session) as stdin/stdout/stderr
+ *	close all other fds
+ *	exec '/bin/sh -c' with the configured string
+ *	(or the command itself, see MT_F_EXEC)
+ *
+ *	does not return - exits on error
+ */
+static void popen_child_setup (chn_t *ch, int fd, const char *tty,
+								char *av[])
+{
+int i;
+struct rlimit r;
+FILE *out;
+
+    if (tty) {
+	(void) setsid ();
+	if ((fd = open (tty, O_RDWR)) == -1)
+	    _exit (EXIT_FAILURE);
+#ifdef TIOCSCTTY
+	(void) ioctl (fd, TIOCSCTTY, 0);
+#endif
+    }
+
+    /* the only way to output error messages is via the 'fd' */
+    if ((out = fdopen (fd, "w")) == NULL)
+	_exit (EXIT_FAILURE);
+
+    /* setup stdin/stdout/stderr */
+    for (i = 0; i < 3; ++i)
+	if (dup2 (fd, i) == -1) {
+	    fprintf (out, "proc setup: dup2(): %s\n", strerror(errno));
+	    fflush (out);
+	    _exit (EXIT_FAILURE);
+	}
+
+    /* close all other fds (including 'fd') */
+#ifdef SYS_close_range
+    if (syscall (SYS_close_range, 3, ~0U, 0) == -1)
+#endif
+    {
+	if (getrlimit (RLIMIT_NOFILE, &r) == -1) {
+	    fprintf (stderr, "proc setup: getrlimit(): %s\n",
+							strerror(errno));
+	    _exit (EXIT_FAILURE);
+	}
+	for (i = 3; i < (int) r.rlim_cur; ++i)
+	    (void) close (i);
+    }
+
+    /* ut ignores SIGPIPE, the process should not */
+    (void) signal (SIGPIPE, SIG_DFL);
+
+    /* everything is setup, now exec */
+    if (ch->cf->method.data & MT_F_EXEC)
+	(void) execvp (av[0], av);
+    else
+	(void) execv ("/bin/sh", av);
+
+    fprintf (stderr, "proc setup: exec(): %s: %s\n", av[0], strerror(errno));
+    _exit (EXIT_FAILURE);
+}
+#endif
+
+
+/*
+ *	pty_open()		[private]
+ *
+ *	allocate a pseudo terminal in raw mode, 'fds' gets
+ *	the master and the (parent's) slave fd, 'tty' the
+ *	path of the slave
+ *
+ *	returns 0 on success, -1 on error (outputs error msg
+ *	on channel 'rid')
+ */
+static int pty_open (chn_t *ch, int rid, int fds[2], char *tty,
+								size_t ttylen)
+{
+const char *name;
+struct termios t;
+#ifdef TIOCSWINSZ
+struct winsize ws;
+#endif
+
+    if ((fds[0] = posix_openpt (O_RDWR | O_NOCTTY)) == -1) {
+	mlpx_printf (rid, MF_ERR, "%s %0*X: posix_openpt(): %s\n",
+			POPEN_OP(rid), mlpx_idlen(), ch->id, strerror(errno));
+	return -1;
+    }
+    if (grantpt (fds[0]) == -1 || unlockpt (fds[0]) == -1 ||
+		! (name = ptsname (fds[0])) || strlen (name) >= ttylen ||
+		(fds[1] = open (name, O_RDWR | O_NOCTTY)) == -1) {
+	mlpx_printf (rid, MF_ERR, "%s %0*X: pty setup: %s\n",
+			POPEN_OP(rid), mlpx_idlen(), ch->id, strerror(errno));
+	(void) close (fds[0]);
+	return -1;
+    }
+    strcpy (tty, name);
+
+    /* no echo, no line editing, no signals, no '\n' -> "\r\n" */
+    if (tcgetattr (fds[1], &t) == 0) {
+	cfmakeraw (&t);
+	(void) tcsetattr (fds[1], TCSANOW, &t);
+    }
+#ifdef TIOCSWINSZ
+    memset (&ws, 0, sizeof ws);
+    ws.ws_row = 24;
+    ws.ws_col = 80;
+    (void) ioctl (fds[1], TIOCSWINSZ, &ws);
+#endif
+
+    return 0;
+}
+
+
+/*
+ *	popen_start()		[private]
+ *
+ *	similar to 'popen()', but:
+ *	 - no STDIO streams
+ *	 - using 'socketpair()' (or a pty, MT_F_PTY)
+ *	 - merge other process' stdout/stderr
+ *	 - optionally without '/bin/sh -c' (MT_F_EXEC)
+ *
+ *	the process' socket (pty master) and pid are
+ *	stored in '*fdp'/'*pidp'
+ *
+ *	returns 0 on success, -1 on error (outputs error msg on
+ *	'rid': CHN_CMD for open, CHN_MSG for the pool)
+ */
+static int popen_start (chn_t *ch, int rid, int *fdp, pid_t *pidp)
+{
+pid_t pid;
+int sp[2], on = 1;
+char tty[64];
+const char *ttyp = 0;
+char *shav[4];
+char **av, **xav = 0;
+
+    if (ch->cf->method.data & MT_F_EXEC) {
+	if (! (av = xav = split_cmd (ch->cf->method.str))) {
+	    mlpx_printf (rid, MF_ERR, "%s %0*X: empty command\n",
+			POPEN_OP(rid), mlpx_idlen(), ch->id);
+	    return -1;
+	}
+    } else {
+	shav[0] = "[ut] sh";
+	shav[1] = "-c";
+	shav[2] = (char*) ch->cf->method.str;
+	shav[3] = 0;
+	av = shav;
+    }
+
+    if (ch->cf->method.data & MT_F_PTY) {
+	if (pty_open (ch, rid, sp, tty, sizeof tty) == -1) {
+	    free (xav);
+	    return -1;
+	}
+	ttyp = tty;
+    } else if (socketpair (AF_LOCAL, SOCK_STREAM, PF_UNSPEC, sp) == -1) {
+	mlpx_printf (rid, MF_ERR, "%s %0*X: socketpair(): %s\n",
+			POPEN_OP(rid), mlpx_idlen(), ch->id, strerror(errno));
+	free (xav);
+	return -1;
+    }
+    (void) fcntl (sp[0], F_SETFD, FD_CLOEXEC);
+
+    /* a process not reading its input must not block the scheduler */
+    if (ioctl (sp[0], FIONBIO, &on) == -1) {
+	mlpx_printf (rid, MF_ERR, "%s %0*X: set FIONBIO: %s\n",
+			POPEN_OP(rid), mlpx_idlen(), ch->id, strerror(errno));
+	(void) close (sp[0]);
+	(void) close (sp[1]);
+	free (xav);
+	return -1;
+    }
+
+#ifdef POPEN_SPAWN
+    pid = popen_spawn (ch, rid, sp[1], ttyp, av);
+#else
+    switch ((pid = fork())) {
+	case -1:
+	    mlpx_printf (rid, MF_ERR, "%s %0*X: fork(): %s\n",
+			POPEN_OP(rid), mlpx_idlen(), ch->id, strerror(errno));
+	    break;
+
+	case 0:
+	    popen_child_setup (ch, sp[1], ttyp, av);	/* does not return */
+	    _exit (EXIT_FAILURE);
+
+	default:
+	    break;
+    }
+#endif
+    free (xav);
+
+    (void) close (sp[1]);
+
+    if (pid == -1) {
+	(void) close (sp[0]);
+	return -1;
+    }
+
+    *fdp = sp[0];
+    *pidp = pid;
+
+    return 0;
+}
+
+
+/*
+ *	process pool
+ *
+ *	a popen channel with 'pool n' keeps n processes
+ *	running while the channel is closed. 'open' hands
+ *	over one of them, the pool is refilled by a timed
+ *	event (i.e., not while handling the command).
+ *	output of an idle process waits in its socket.
+ *	idle processes which exit are noticed on SIGCHLD
+ *	(see proc.c) and replaced after POOL_RETRY.
+ */
+#define POOL_RETRY	5000		/* ms until retry after error	*/
+
+struct ppool {
+	int		n;		/* # of idle processes		*/
+	int		fd[UT_POOLMAX];	/* their sockets		*/
+	pid_t		pid[UT_POOLMAX];
+	timedev_t	te;		/* refill			*/
+	int		tepend;		/* 'te' is scheduled		*/
+	chn_t		*ch;		/* owner			*/
+	struct ppool	*next;		/* list of all pools		*/
+};
+
+static struct ppool *pools = 0;		/* channels with a pool		*/
+
+
+/*
+ *	pool_timed()		[private]
+ *
+ *	timed event: refill the pool of 'ch'
+ */
+static void pool_timed (timedev_t *te)
+{
+chn_t *ch = te->data;
+struct ppool *pp = ch->pp;
+
+    pp->tepend = 0;
+
+    /* (no open waits for this, errors go to CHN_MSG) */
+    while (pp->n < ch->cf->pool)
+	if (popen_start (ch, CHN_MSG, &pp->fd[pp->n], &pp->pid[pp->n]) == -1) {
+	    te->inms = POOL_RETRY;
+	    if (! tesc_timedev (te))
+		pp->tepend = 1;
+	    break;
+	} else
+	    ++pp->n;
+
+    return;
+}
+
+
+/*
+ *	pool_sched()		[private]
+ *
+ *	schedule (re-)filling the process pool of 'ch'
+ *	in 'ms' milliseconds (if configured)
+ */
+static void pool_sched (chn_t *ch, int ms)
+{
+    if (! ch->cf || ch->cf->method.type != mtPOPEN || ! ch->cf->pool)
+	return;
+
+    if (! ch->pp) {
+	ch->pp = sec_malloc (sizeof(struct ppool));	/* may exit */
+	ch->pp->n = 0;
+	ch->pp->tepend = 0;
+	ch->pp->ch = ch;
+	ch->pp->next = pools;
+	pools = ch->pp;
+    }
+    if (ch->pp->tepend)
+	return;
+
+    ch->pp->te.inms = ms;
+    ch->pp->te.func = pool_timed;
+    ch->pp->te.data = ch;
+    if (! tesc_timedev (&ch->pp->te))
+	ch->pp->tepend = 1;
+
+    return;
+}
+
+
+/*
+ *	pool_drop()		[private]
+ *
+ *	remove idle process 'i' from the pool of 'ch' if it
+ *	has exited (status is reported)
+ *
+ *	returns 1 if it was removed, 0 if it is still running
+ */
+static int pool_drop (chn_t *ch, int i)
+{
+struct ppool *pp = ch->pp;
+
+    if (! proc_check (pp->pid[i]))
+	return 0;
+
+    mlpx_printf (CHN_MSG, MF_ERR, "pool %0*X: idle process %u exited\n",
+				mlpx_idlen(), ch->id, (unsigned) pp->pid[i]);
+    (void) close (pp->fd[i]);
+
+    /* last one takes its place */
+    --pp->n;
+    pp->fd[i] = pp->fd[pp->n];
+    pp->pid[i] = pp->pid[pp->n];
+
+    return 1;
+}
+
+
+/*
+ *	cmdi_pool_fill()
+ *
+ *	schedule (re-)filling the process pool of 'ch'
+ *	(if configured)
+ */
+void cmdi_pool_fill (chn_t *ch)
+{
+    pool_sched (ch, 0);
+
+    return;
+}
+
+
+/*
+ *	cmdi_pool_reap()
+ *
+ *	called by proc.c on SIGCHLD: remove idle processes
+ *	which have exited from all pools, they are replaced
+ *	after POOL_RETRY (a command which exits at once
+ *	must not be restarted over and over)
+ */
+void cmdi_pool_reap (void)
+{
+struct ppool *pp;
+int i, gone;
+
+    for (pp = pools; pp; pp = pp->next) {
+	for (i = pp->n - 1, gone = 0; i >= 0; --i)
+	    gone += pool_drop (pp->ch, i);
+	if (gone)
+	    pool_sched (pp->ch, POOL_RETRY);
+    }
+
+    return;
+}
+
+
+/*
+ *	cmdi_pool_free()
+ *
+ *	terminate the idle processes of 'ch', free the pool
+ */
+void cmdi_pool_free (chn_t *ch)
+{
+struct ppool *pp = ch->pp, **p;
+
+    if (! pp)
+	return;
+
+    for (p = &pools; *p != pp; p = &(*p)->next)
+	;
+    *p = pp->next;
+
+    if (pp->tepend)
+	tesc_untimedev (&pp->te);
+
+    while (pp->n > 0) {
+	--pp->n;
+	(void) close (pp->fd[pp->n]);
+	proc_reap (pp->pid[pp->n]);
+    }
+
+    free (pp);
+    ch->pp = 0;
+
+    return;
+}
+
+
+/*
+ *	cmdi_open_POPEN()	[private]
+ *
+ *	start the process (or take one from the pool)
+ *
+ *	return value like cmdi_open()
+ */
+static int cmdi_open_POPEN (chn_t *ch)
+{
+    /* (in case a SIGCHLD is not handled yet) */
+    while (ch->pp && ch->pp->n > 0 && pool_drop (ch, ch->pp->n - 1))
+	;
+
+    if (ch->pp && ch->pp->n > 0) {
+	/* already running */
+	--ch->pp->n;
+	ch->fd = ch->pp->fd[ch->pp->n];
+	ch->pid = ch->pp->pid[ch->pp->n];
+    } else if (popen_start (ch, CHN_CMD, &ch->fd, &ch->pid) == -1) {
+	ch->fd = -1;
+	return -1;
+    }
+
+    /* replace it in the background */
+    cmdi_pool_fill (ch);
+
+    /* mark channel open R/W with process */
+    ch->flags = CHN_F_RD | CHN_F_WR | CHN_F_PROC;
+
+    /* buffers, logfile, motd */
+    mlpx_setup_ch (ch);
+
+    return 0;
+}
+
+
+/*
+ *	cmdi_open_FILE()	[private]
+ *
+ *	open a file for reading (mtREAD, the channel gets EOF at
+ *	the end of the file) or appending (mtWRITE)
+ *
+ *	a read channel is paced by the main output, see chn_input()
+ *
+ *	return value like cmdi_open()
+ */
+static int cmdi_open_FILE (chn_t *ch)
+{
+const char *path = ch->cf->method.str;
+
+    if (ch->cf->method.type == mtREAD)
+	ch->fd = open (path, O_RDONLY | O_NONBLOCK | O_NOCTTY);
+    else
+	ch->fd = open (path, O_WRONLY | O_APPEND | O_CREAT | O_NONBLOCK |
+							O_NOCTTY, 0644);
+    if (ch->fd == -1) {
+	mlpx_printf (CHN_CMD, MF_ERR, "open %0*X: %s: %s\n",
+			mlpx_idlen(), ch->id, path, strerror(errno));
+	return -1;
+    }
+    (void) fcntl (ch->fd, F_SETFD, FD_CLOEXEC);
+
+    if (ch->cf->method.type == mtREAD) {
+#ifdef POSIX_FADV_SEQUENTIAL
+	(void) posix_fadvise (ch->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	ch->roff = 0;
+	ch->flags = CHN_F_RD;
+    } else
+	ch->flags = CHN_F_WR;
+
+    /* buffers, logfile, motd */
+    mlpx_setup_ch (ch);
+
+    return 0;
+}
+
+
+/*
+ *	arg2id()		[private]
+ *
+ *	convert leading (hex) digits of 's' to a channel id,
+ *	at most mlpx_idlen() digits. '*end' is set to the
+ *	first char not converted.
+ *
+ *	return -1 on failure
+ */
+static int arg2id (const char *s, const char **end)
+{
+int i, id;
+
+    for (i = 0, id = 0; s[i] && ishexdigit (s[i]); ++i)
+	id = id * 16 + hexd2int (s[i]);
+
+    *end = s + i;
+
+    if (i == 0 || i > mlpx_idlen())
+	return -1;
+
+    return id;
+}
+
+
+/*
+ *	arg2chn()		[private]
+ *
+ *	convert (hex) string to channel,
+ *	return 0 on failure.
+ *
+ *	(outputs error msgs on failure)
+ */
+static chn_t *arg2chn (const char *s)
+{
+int id;
+chn_t *ch;
+
+    /* (try to) get channel */
+    if ((id = arg2id (s, &s)) == -1 || *s) {
+	mlpx_printf (CHN_MSG, MF_ERR, "invalid channel id\n");
+	return 0;
+    }
+
+    ch = mlpx_id2chn (id);
+
+    if (!ch) {
+	mlpx_printf (CHN_MSG, MF_ERR, "no such channel\n");
+	return 0;
+    }
+
+    return ch;
+}
+
+
+/*
+ *	arg2chnlist()		[private]
+ *
+ *	convert a list of channels to an array of chn_t ptrs
+ *	(allocated, stored in '*chsp'). the list is either
+ *	'all' or a comma separated list of (hex) channel
+ *	ids and ranges, e.g., '01,03-07,1A'.
+ *
+ *	ranges and 'all' silently skip undefined ids as
+ *	well as CHN_CMD and CHN_MSG.
+ *
+ *	if 'explp' is not 0, '*explp' gets an array (allocated,
+ *	parallel to '*chsp') telling which channels were listed
+ *	by their id (1) rather than by a range or 'all' (0)
+ *
+ *	return # of channels in the array, -1 on failure
+ *	(outputs error msgs on failure)
+ */
+static int arg2chnlist (const char *s, chn_t ***chsp, char **explp)
+{
+int n, max, lo, hi, id, single;
+chn_t *ch;
+chn_t **chs;
+char *expl;
+
+    n = 0;
+    max = 16;
+    chs = sec_malloc (max * sizeof(*chs));		/* may exit */
+    expl = sec_malloc (max);				/* may exit */
+
+    if (! strcmp (s, "all")) {
+	lo = 0;
+	hi = mlpx_topid();
+	single = 0;
+	s = "";
+    } else
+	lo = hi = single = -1;
+
+    while (1) {
+	if (lo == -1) {
+	    /* parse next item */
+	    if ((lo = arg2id (s, &s)) == -1) {
+		mlpx_printf (CHN_MSG, MF_ERR, "invalid channel id\n");
+		free (chs);
+		free (expl);
+		return -1;
+	    }
+	    if (*s == '-') {
+		if ((hi = arg2id (s + 1, &s)) == -1 || hi < lo) {
+		    mlpx_printf (CHN_MSG, MF_ERR, "invalid channel range\n");
+		    free (chs);
+		    free (expl);
+		    return -1;
+		}
+		single = 0;
+	    } else {
+		hi = lo;
+		single = 1;
+	    }
+	    if (*s != ',' && *s) {
+		mlpx_printf (CHN_MSG, MF_ERR, "invalid channel list\n");
+		free (chs);
+		free (expl);
+		return -1;
+	    }
+	}
+
+	/* (ranges end at the last id which may be in use) */
+	if (! single && hi > mlpx_topid())
+	    hi = mlpx_topid();
+
+	for (id = lo; id <= hi; ++id) {
+	    if (! (ch = mlpx_id2chn (id))) {
+		if (! single)
+		    continue;
+		mlpx_printf (CHN_MSG, MF_ERR, "no such channel\n");
+		free (chs);
+		free (expl);
+		return -1;
+	    }
+	    if (! single && (id == CHN_CMD || id == CHN_MSG))
+		continue;
+
+	    if (n == max) {
+		max *= 2;
+		chs = sec_realloc (chs, max * sizeof(*chs));	/* may exit */
+		expl = sec_realloc (expl, max);			/* may exit */
+	    }
+	    expl[n] = single;
+	    chs[n++] = ch;
+	}
+
+	if (! *s)
+	    break;	/* done */
+
+	++s;		/* skip ',' */
+	lo = -1;
+    }
+
+    *chsp = chs;
+    if (explp)
+	*explp = expl;
+    else
+	free (expl);
+
+    return n;
+}
+
+
+/*
+ *	open_chn()		[private]
+ *
+ *	call the method specific open function for 'ch'
+ *
+ *	return value like cmdi_open()
+ */
+static int open_chn (chn_t *ch)
+{
+int r;
+
+    if (ch->lsn) {
+	mlpx_printf (CHN_MSG, MF_ERR, "channel %0*X is an accepted "
+				"connection, cannot be reopened\n",
+							mlpx_idlen(), ch->id);
+	return -1;
+    }
+
+    switch (ch->cf->method.type) {
+	case mtUNIX:
+	    r = cmdi_open_UNIX (ch);
+	    break;
+
+	case mtINET:
+	case mtUDP:
+	    r = cmdi_open_INET (ch);
+	    break;
+
+	case mtPOPEN:
+	    r = cmdi_open_POPEN (ch);
+	    break;
+
+	case mtREAD:
+	case mtWRITE:
+	    r = cmdi_open_FILE (ch);
+	    break;
+
+	case mtFOLLOW:
+	    r = fwat_follow (ch);
+	    break;
+
+	case mtLUNIX:
+	case mtLINET:
+	    r = cmdi_open_LISTEN (ch);
+	    break;
+
+	default:
+	    mlpx_printf (CHN_MSG, MF_ERR, "the access method defined for"
+				" this channel is not implemented, sorry\n");
+	    return -1;
+    }
+
+    if (r == -2 && ! (ch->flags & CHN_F_PEND)) {
+	/* we need an fdio in order be noticed by scheduler */
+	tesc_enq_wq (ch, 0);
+	tesc_keep (ch);
+    }
+
+    if (r == -2)
+	oto_start (ch);
+    else if (r == -1)
+	ao_arm (ch);
+
+    return r;
+}
+
+
+/*
+ *	open timeout
+ *
+ *	an open which does not complete immediately (name resolution,
+ *	nonblocking connect/open) is failed after cf->ctimeout seconds
+ */
+
+struct opento {
+	timedev_t	te;
+	int		pend;		/* 'te' is scheduled		*/
+};
+
+
+/*
+ *	oto_timed()		[private, used for tesc_timedev()]
+ *
+ *	open did not complete in time: abort it, fail like
+ *	cmdi_handle_ntf() does
+ */
+static void oto_timed (timedev_t *te)
+{
+chn_t *ch = te->data;
+
+    ch->oto->pend = 0;
+
+    mlpx_printf (CHN_CMD, MF_ERR, "open %0*X: timeout\n",
+							mlpx_idlen(), ch->id);
+
+    if (ch->iop)
+	he_free (ch->iop);		/* close all connect attempts */
+
+    ch->flags &= ~CHN_F_RES;		/* no resolver result */
+    resv_cancel (ch);
+
+    if (ch->flags & CHN_F_IP) {
+	(void) close (ch->fd);
+	orn_purge (ch);
+	mlpx_cleanup_ch (ch);
+    }
+
+    open_report (ch, -1);
+
+    return;
+}
+
+
+/*
+ *	oto_start()		[private]
+ */
+static void oto_start (chn_t *ch)
+{
+    if (! ch->cf->ctimeout)
+	return;
+
+    if (! ch->oto) {
+	ch->oto = sec_malloc (sizeof(struct opento));	/* may exit */
+	ch->oto->pend = 0;
+    }
+    if (ch->oto->pend)
+	return;
+
+    ch->oto->te.inms = ch->cf->ctimeout * 1000;
+    ch->oto->te.func = oto_timed;
+    ch->oto->te.data = ch;
+    if (! tesc_timedev (&ch->oto->te))
+	ch->oto->pend = 1;
+
+    return;
+}
+
+
+/*
+ *	oto_cancel()		[private]
+ */
+static void oto_cancel (chn_t *ch)
+{
+    if (ch->oto && ch->oto->pend) {
+	(void) tesc_untimedev (&ch->oto->te);
+	ch->oto->pend = 0;
+    }
+
+    return;
+}
+
+
+/*
+ *	automatic reconnect for socket channels (config: reconnect)
+ *
+ *	if a channel with a reconnect policy gets EOF (or errors),
+ *	it is reopened after a delay. the delay starts at 'delay'
+ *	ms and is doubled after each failed attempt (up to
+ *	'maxdelay'), the actual wait is randomly chosen between
+ *	half and all of it. after 'tries' failed attempts (if set)
+ *	ut gives up. state changes are reported on CHN_CMD:
+ *
+ *	  RECONNECT XX WAIT ms	-- next attempt in ms
+ *	  RECONNECT XX OK	-- channel is open again
+ *	  RECONNECT XX FAIL	-- given up, channel stays closed
+ */
+
+struct recon {
+	int		cur;		/* current delay (ms)		*/
+	int		tries;		/* # of failed attempts		*/
+	int		active;		/* reconnect in progress	*/
+	timedev_t	te;		/* next attempt			*/
+	int		tepend;		/* 'te' is scheduled		*/
+};
+
+
+/*
+ *	rc_timed()		[private, used for tesc_timedev()]
+ *
+ *	time for the next reconnect attempt
+ */
+static void rc_timed (timedev_t *te)
+{
+chn_t *ch = te->data;
+int r;
+
+    ch->rc->tepend = 0;
+    ch->flags &= ~CHN_F_RCW;
+
+    if ((r = open_chn (ch)) != -2)
+	open_report (ch, r);
+
+    return;
+}
+
+
+/*
+ *	rc_schedule()		[private]
+ *
+ *	schedule next reconnect attempt
+ */
+static void rc_schedule (chn_t *ch)
+{
+struct recon *rc = ch->rc;
+static int seeded = 0;
+int d;
+
+    if (! seeded) {
+	srandom (time (0) ^ getpid ());
+	seeded = 1;
+    }
+
+    /* "equal jitter": between half and all of the current delay */
+    d = rc->cur / 2 + random () % (rc->cur - rc->cur / 2 + 1);
+
+    rc->te.inms = d;
+    rc->te.func = rc_timed;
+    rc->te.data = ch;
+    if (tesc_timedev (&rc->te)) {
+	mlpx_printf (CHN_CMD, 0, "RECONNECT %0*X FAIL\n",
+						mlpx_idlen(), ch->id);
+	rc->active = 0;
+	return;
+    }
+    rc->tepend = 1;
+    ch->flags |= CHN_F_RCW;
+
+    mlpx_printf (CHN_CMD, 0, "RECONNECT %0*X WAIT %d\n",
+						mlpx_idlen(), ch->id, d);
+
+    return;
+}
+
+
+/*
+ *	rc_cancel()		[private]
+ *
+ *	stop reconnecting (channel opened / closed by command)
+ */
+static void rc_cancel (chn_t *ch)
+{
+    ao_cancel (ch);
+
+    if (! ch->rc)
+	return;
+
+    if (ch->rc->tepend)
+	(void) tesc_untimedev (&ch->rc->te);
+    ch->rc->tepend = 0;
+    ch->rc->active = 0;
+    ch->flags &= ~CHN_F_RCW;
+
+    return;
+}
+
+
+/*
+ *	cmdi_reconnect()
+ *
+ *	channel 'ch' was closed because of EOF / errors,
+ *	start reconnecting if configured
+ */
+void cmdi_reconnect (chn_t *ch)
+{
+    if (ch->cf && ch->cf->autoopen) {
+	ao_arm (ch);
+	return;
+    }
+
+    if (! ch->cf || ! ch->cf->rcdelay)
+	return;
+
+    if (! ch->rc) {
+	ch->rc = sec_malloc (sizeof(struct recon));	/* may exit */
+	ch->rc->tepend = 0;
+    }
+
+    ch->rc->active = 1;
+    ch->rc->cur = ch->cf->rcdelay;
+    ch->rc->tries = 0;
+
+    rc_schedule (ch);
+
+    return;
+}
+
+
+/*
+ *	automatic open for unix socket channels (config: autoopen)
+ *
+ *	if the open of such a channel fails (or it gets EOF), the
+ *	socket is watched (see fwat.c) and the channel is opened as
+ *	soon as the socket appears or changes. since the daemon may
+ *	not listen yet when the socket is created, a failed attempt
+ *	is repeated up to AO_TRIES times (starting after AO_DELAY ms,
+ *	doubling the delay). reported on CHN_CMD:
+ *
+ *	  AUTOOPEN XX WAIT	-- waiting for the socket
+ *	  AUTOOPEN XX OK	-- channel is open
+ */
+
+struct aopen {
+	struct fwat	*fw;		/* watch for the socket (or 0)	*/
+	int		tries;		/* # of attempts since change	*/
+	timedev_t	te;		/* next attempt			*/
+	int		tepend;		/* 'te' is scheduled		*/
+};
+
+
+/*
+ *	ao_try()		[private]
+ *
+ *	attempt to open 'ch'
+ */
+static void ao_try (chn_t *ch)
+{
+int r;
+
+    ch->flags &= ~CHN_F_RCW;
+    ++ch->ao->tries;
+
+    if ((r = open_chn (ch)) != -2)
+	open_report (ch, r);
+
+    return;
+}
+
+
+/*
+ *	ao_timed()		[private, used for tesc_timedev()]
+ *
+ *	time for the next attempt
+ */
+static void ao_timed (timedev_t *te)
+{
+chn_t *ch = te->data;
+
+    ch->ao->tepend = 0;
+    ao_try (ch);
+
+    return;
+}
+
+
+/*
+ *	ao_schedule()		[private]
+ *
+ *	next attempt in 'ms' ms
+ */
+static void ao_schedule (chn_t *ch, int ms)
+{
+struct aopen *ao = ch->ao;
+
+    ao->te.inms = ms;
+    ao->te.func = ao_timed;
+    ao->te.data = ch;
+    ao->tepend = ! tesc_timedev (&ao->te);
+
+    return;
+}
+
+
+/*
+ *	ao_event()		[private, used for fwat_add()]
+ *
+ *	the socket (or its directory entry) changed
+ */
+static void ao_event (void *data)
+{
+chn_t *ch = data;
+
+    if (ch->flags & (CHN_F_ACT | CHN_F_IP | CHN_F_PEND))
+	return;		/* attempt in progress */
+
+    if (ch->ao->tepend) {
+	(void) tesc_untimedev (&ch->ao->te);
+	ch->ao->tepend = 0;
+    }
+    ch->ao->tries = 0;
+
+    ao_try (ch);
+
+    return;
+}
+
+
+/*
+ *	ao_done()		[private]
+ *
+ *	result 'r' of an attempt (like cmdi_open())
+ */
+static void ao_done (chn_t *ch, int r)
+{
+struct aopen *ao = ch->ao;
+
+    if (r == 0) {
+	ao_cancel (ch);
+	mlpx_printf (CHN_CMD, 0, "AUTOOPEN %0*X OK\n", mlpx_idlen(), ch->id);
+	return;
+    }
+
+    ch->flags |= CHN_F_RCW;
+
+    if (ao->tries < AO_TRIES)
+	ao_schedule (ch, AO_DELAY << (ao->tries - 1));
+    /* else wait for the next change */
+
+    return;
+}
+
+
+/*
+ *	ao_arm()		[private]
+ *
+ *	start watching for the socket of 'ch' (if configured)
+ */
+static void ao_arm (chn_t *ch)
+{
+struct stat st;
+
+    if (! ch->cf || ! ch->cf->autoopen)
+	return;
+
+    if (! ch->ao) {
+	ch->ao = sec_malloc (sizeof(struct aopen));	/* may exit */
+	ch->ao->fw = 0;
+	ch->ao->tepend = 0;
+    }
+
+    if (ch->ao->fw)
+	return;		/* already watching */
+
+    if (! (ch->ao->fw = fwat_add (ch->cf->method.str, ao_event, ch)))
+	return;
+    ch->ao->tries = 0;
+    ch->flags |= CHN_F_RCW;
+
+    mlpx_printf (CHN_CMD, 0, "AUTOOPEN %0*X WAIT\n", mlpx_idlen(), ch->id);
+
+    /* it may have appeared before the watch was set up */
+    if (lstat (ch->cf->method.str, &st) == 0 && S_ISSOCK(st.st_mode))
+	ao_schedule (ch, AO_DELAY);
+
+    return;
+}
+
+
+/*
+ *	ao_cancel()		[private]
+ *
+ *	stop watching (channel opened / closed by command)
+ */
+static void ao_cancel (chn_t *ch)
+{
+    if (! ch->ao)
+	return;
+
+    if (ch->ao->fw)
+	fwat_del (ch->ao->fw);
+    ch->ao->fw = 0;
+    if (ch->ao->tepend)
+	(void) tesc_untimedev (&ch->ao->te);
+    ch->ao->tepend = 0;
+    ch->flags &= ~CHN_F_RCW;
+
+    return;
+}
+
+
+/*
+ *	bulk open
+ *
+ *	'open' with a list of channels starts all opens at once
+ *	and answers with a single line: WAIT when some of them
+ *	are still in progress, and later (or right away) OK, or
+ *	FAIL followed by the ids of the channels that failed.
+ */
+struct bulk {
+	char		*spec;		/* channel list as given	*/
+	char		*tag;		/* request tag (or 0)		*/
+	int		pend;		/* # of opens in progress	*/
+	char		*failed;	/* ids that failed (or 0)	*/
+	size_t		flen;		/* strlen(failed)		*/
+};
+
+
+/*
+ *	bulk_fail()		[private]
+ *
+ *	add channel 'id' to the failed list of 'b'
+ */
+static void bulk_fail (struct bulk *b, int id)
+{
+char buf[CHN_XIDLEN + 2];
+int l;
+
+    if (b->flen + CHN_XIDLEN + 1 > BULK_FAILMAX) {
+	/* list is full, mark as truncated (once) */
+	if (b->failed[b->flen - 1] == '.')
+	    return;
+	l = sprintf (buf, ",...");
+    } else
+	l = sprintf (buf, "%s%0*X", b->failed ? "," : "", mlpx_idlen(), id);
+    b->failed = sec_realloc (b->failed, b->flen + l + 1);	/* may exit */
+    strcpy (b->failed + b->flen, buf);
+    b->flen += l;
+
+    return;
+}
+
+
+/*
+ *	bulk_end()		[private]
+ *
+ *	output the final result for 'b', free 'b'
+ */
+static void bulk_end (struct bulk *b)
+{
+
+    if (b->failed)
+	cmdi_reply (b->tag, "FAIL open %s %s\n", b->spec, b->failed);
+    else
+	cmdi_reply (b->tag, "OK open %s\n", b->spec);
+
+    free (b->failed);
+    free (b->tag);
+    free (b->spec);
+    free (b);
+
+    return;
+}
+
+
+/*
+ *	bulk_done()		[private]
+ *
+ *	the open of 'ch' (part of a bulk open) is done,
+ *	'r' is the result (0 ok, -1 failed)
+ */
+static void bulk_done (chn_t *ch, int r)
+{
+struct bulk *b = ch->blk;
+
+    ch->blk = 0;
+
+    if (r == -1)
+	bulk_fail (b, ch->id);
+
+    if (--b->pend == 0)
+	bulk_end (b);
+
+    return;
+}
+
+
+/*
+ *	bulk_open()		[private]
+ *
+ *	open all channels in the list 's' (see arg2chnlist()),
+ *	channels already open are skipped
+ *
+ *	returns: 1 (result already sent), -1 error
+ */
+static int bulk_open (const char *s)
+{
+int i, n, r;
+chn_t *ch;
+chn_t **chs;
+struct bulk *b;
+
+    if ((n = arg2chnlist (s, &chs, 0)) == -1)
+	return -1;
+
+    b = sec_malloc (sizeof(struct bulk));		/* may exit */
+    b->spec = sec_malloc (strlen (s) + 1);		/* may exit */
+    strcpy (b->spec, s);
+    b->tag = tag_dup ();
+    b->pend = 0;
+    b->failed = 0;
+    b->flen = 0;
+
+    for (i = 0; i < n; ++i) {
+	ch = chs[i];
+
+	if (ch->flags & (CHN_F_ACT | CHN_F_IP | CHN_F_PEND))
+	    continue;	/* already open */
+
+	rc_cancel (ch);
+
+	if ((r = open_chn (ch)) == -1) {
+	    mlpx_printf (CHN_MSG, MF_ERR, "open channel %0*X failed\n",
+							mlpx_idlen(), ch->id);
+	    bulk_fail (b, ch->id);
+	} else if (r == -2) {
+	    /* result is reported by open_report() */
+	    ch->blk = b;
+	    ++b->pend;
+	}
+    }
+    free (chs);
+
+    if (b->pend)
+	cmdi_reply (cmd_tag, "WAIT open %s\n", b->spec);
+    else
+	bulk_end (b);
+
+    return 1;
+}
+
+
+/*
+ *	open_report()		[private]
+ *
+ *	report the result of an open completed asynchronously
+ *	(or of a reconnect attempt)
+ */
+static void open_report (chn_t *ch, int r)
+{
+struct recon *rc = ch->rc;
+
+    if (r != -2)
+	oto_cancel (ch);	/* open is done */
+
+    if (ch->ao && ch->ao->fw) {
+	if (r != -2)
+	    ao_done (ch, r);
+	return;
+    }
+
+    if (r == -1)
+	ao_arm (ch);
+
+    if (ch->blk) {
+	if (r != -2)
+	    bulk_done (ch, r);
+	return;
+    }
+
+    if (rc && rc->active) {
+	if (r == 0) {
+	    mlpx_printf (CHN_CMD, 0, "RECONNECT %0*X OK\n",
+						mlpx_idlen(), ch->id);
+	    rc->active = 0;
+
+	} else if (r == -1) {
+	    if (ch->cf->rctries && ++rc->tries >= ch->cf->rctries) {
+		mlpx_printf (CHN_CMD, 0, "RECONNECT %0*X FAIL\n",
+						mlpx_idlen(), ch->id);
+		rc->active = 0;
+		return;
+	    }
+	    if ((rc->cur *= 2) > ch->cf->rcmax)
+		rc->cur = ch->cf->rcmax;
+	    rc_schedule (ch);
+	}
+	return;
+    }
+
+    if (r == -2)
+	return;		/* still in progress */
+
+    if (r == -1)
+	cmdi_reply (ch->tag, "FAIL open %0*X\n", mlpx_idlen(), ch->id);
+    else
+	cmdi_reply (ch->tag, "OK open %0*X\n", mlpx_idlen(), ch->id);
+
+    free (ch->tag);
+    ch->tag = 0;
+
+    return;
+}
+
+
+/*
+ *	cmdi_open()		[private]
+ *
+ *	open command, args:
+ *	1: channel id, or a list of channels (see bulk_open())
+ *
+ *	returns: 0 ok, -1 error, -2 inprogress, 1 bulk open
+ */
+static int cmdi_open (int ac, char *av[])
+{
+int r;
+chn_t *ch;
+
+    if (ac < 2) {
+	mlpx_printf (CHN_MSG, MF_ERR,
+				"missing channel argument for %s\n", av[0]);
+	return -1;
+    } else if (ac > 2)
+	mlpx_printf (CHN_MSG, 0, "extra args for command %s ignored\n", av[0]);
+
+    if (strpbrk (av[1], ",-") || ! strcmp (av[1], "all"))
+	return bulk_open (av[1]);
+
+    /* (try to) get channel to open */
+    if (! (ch = arg2chn (av[1])))
+	return -1;
+
+    if ((ch->flags & (CHN_F_ACT | CHN_F_IP | CHN_F_PEND))) {
+	/* channel is already open */
+	mlpx_printf (CHN_MSG, MF_ERR, "channel %0*X is already open\n",
+							mlpx_idlen(), ch->id);
+	return -1;
+    }
+
+    /* waiting for reconnect: open right now */
+    rc_cancel (ch);
+
+    /* now jump to the method specific part */
+    if ((r = open_chn (ch)) == -1)
+	mlpx_printf (CHN_MSG, MF_ERR, "open channel %s failed\n", av[1]);
+    else if (r == -2)
+	ch->tag = tag_dup ();	/* for the async reply */
+
+    return r;	/* result from method specific part */
+}
+
+
+/*
+ *	close_chn()		[private]
+ *
+ *	close channel 'ch', abort an open in progress
+ */
+static void close_chn (chn_t *ch)
+{
+
+    /***
+     *** FIXME: we should check if the output queue is empty
+     *** and wait for it to drain (unless forced - 'close -f', or
+     *** perhaps issue a second close command to force it)
+     ***/
+
+    /* no more reconnects, open in progress is aborted */
+    rc_cancel (ch);
+    oto_cancel (ch);
+    if (ch->blk)
+	bulk_done (ch, -1);
+    free (ch->tag);
+    ch->tag = 0;
+
+    /* no resolver result */
+    ch->flags &= ~CHN_F_RES;
+    resv_cancel (ch);
+
+    /* stop connect attempts */
+    if (ch->iop)
+	he_free (ch->iop);
+
+    /* close/free */
+    if (ch->fd != -1) {
+	(void) close (ch->fd);
+
+	/* a listening unix socket is removed */
+	if (ch->cf && ch->cf->method.type == mtLUNIX && ! ch->lsn)
+	    (void) unlink (ch->cf->method.str);
+    }
+
+    if (ch->flags & CHN_F_PROC)
+	proc_reap (ch->pid);
+
+    if (ch->flags & CHN_F_ACT)
+	mlpx_cleanup_ch (ch);
+
+    /* accepted connections go away when closed */
+    mlpx_drop_chn (ch);
+
+    return;
+}
+
+
+/*
+ *	bulk_close()		[private]
  *
- *	close all fds except the argument 'fd'
- *	setup 'fd' as stdin/stdout/stderr
- *	exec '/bin/sh -c' with the configure string
+ *	close all channels in the list 's' (see arg2chnlist()),
+ *	channels not open are skipped
  *
- *	does not return - exits on error
+ *	returns: 1 (result already sent), -1 error
  */
-static void popen_child_setup (chn_t *ch, int fd)
+static int bulk_close (const char *s)
 {
-int i;
-struct rlimit r;
-FILE *out;
-const char *cmd;
-
-    cmd = ch->cf->method.str;
-
-    /* the only way to output error messages is via the 'fd' */
-    if ((out = fdopen (fd, "w")) == NULL)
-	exit (EXIT_FAILURE);
+int i, n;
+chn_t **chs;
 
-    /* close all fds except 'fd' */
-    if (getrlimit (RLIMIT_NOFILE, &r) == -1) {
-	fprintf (out, "proc setup: getrlimit(): %s\n", strerror(errno));
-	fflush (out);
-	_exit (EXIT_FAILURE);
-    }
-    for (i = 0; i < (int) r.rlim_cur; ++i)
-	if (i == fd)
-	    continue;
-	else
-	    (void) close (i);
+    if ((n = arg2chnlist (s, &chs, 0)) == -1)
+	return -1;
 
-    /* setup stdin/stdout/stderr */
-    for (i = 0; i < 3; ++i)
-	if (dup2 (fd, i) == -1) {
-	    fprintf (out, "proc setup: dup2(): %s\n", strerror(errno));
-	    fflush (out);
-	    _exit (EXIT_FAILURE);
+    for (i = 0; i < n; ++i)
+	if (chs[i]->id == CHN_CMD || chs[i]->id == CHN_MSG) {
+	    mlpx_printf (CHN_MSG, MF_ERR, "cannot close channel %0*X\n",
+						mlpx_idlen(), chs[i]->id);
+	    free (chs);
+	    return -1;
 	}
-    if (fd > 2)		/* should always be the case */
-	(void) fclose (out);
 
-    /* everything is setup, now exec a shell with the configured cmd */
-    if (execl ("/bin/sh", "[ut] sh", "-c", cmd, (char*) 0) == -1) {
-	fprintf (stderr, "proc setup: execl(): %s\n", strerror(errno));
-	exit (EXIT_FAILURE);
-    }
+    for (i = 0; i < n; ++i)
+	if (chs[i]->flags & (CHN_F_ACT | CHN_F_IP | CHN_F_PEND | CHN_F_RCW))
+	    close_chn (chs[i]);
+    free (chs);
+
+    cmdi_reply (cmd_tag, "OK close %s\n", s);
 
-    return;	/* not reached */
+    return 1;
 }
 
 
 /*
- *	cmdi_open_POPEN()	[private]
+ *	cmdi_close()		[private]
  *
- *	similar to 'popen()', but:
- *	 - no STDIO streams
- *	 - using 'socketpair()'
- *	 - merge other process' stdout/stderr
+ *	close command, args:
+ *	1: channel id, or a list of channels (see bulk_close())
  *
- *	return value like cmdi_open()
+ *	returns: 0 ok, -1 error, 1 bulk close
  */
-static int cmdi_open_POPEN (chn_t *ch)
+static int cmdi_close (int ac, char *av[])
 {
-pid_t pid;
-int sp[2];
+chn_t *ch;
 
-    if (socketpair (AF_LOCAL, SOCK_STREAM, PF_UNSPEC, sp) == -1) {
-	mlpx_printf (CHN_CMD, MF_ERR, "open %02X: socketpair(): %s\n",
-						ch->id, strerror(errno));
-	ch->fd = -1;
+    if (ac < 2) {
+	mlpx_printf (CHN_MSG, MF_ERR,
+				"missing channel argument for %s\n", av[0]);
 	return -1;
-    }
+    } else if (ac > 2)
+	mlpx_printf (CHN_MSG, 0, "extra args for command %s ignored\n", av[0]);
 
-    switch ((pid = fork())) {
-	case -1:
-	    mlpx_printf (CHN_CMD, MF_ERR, "open %02X: fork(): %s\n",
-						ch->id, strerror(errno));
-	    (void) close (sp[0]);
-	    (void) close (sp[1]);
-	    ch->fd = -1;
-	    return -1;
+    if (strpbrk (av[1], ",-") || ! strcmp (av[1], "all"))
+	return bulk_close (av[1]);
 
-	case 0:
-	    (void) close (sp[0]);
-	    popen_child_setup (ch, sp[1]);	/* does not return */
-	    exit (EXIT_FAILURE); 
+    /* (try to) get channel to close */
+    if (! (ch = arg2chn (av[1])))
+	return -1;
 
-	default:
-	    break;
+    if (! (ch->flags & (CHN_F_ACT | CHN_F_IP | CHN_F_PEND | CHN_F_RCW))) {
+	/* channel is not open */
+	mlpx_printf (CHN_MSG, MF_ERR, "channel %0*X is not open\n",
+							mlpx_idlen(), ch->id);
+	return -1;
     }
 
-    /* parent side setup */
-    (void) close (sp[1]);
-    ch->fd = sp[0];
-    ch->pid = pid;
-
-    /* mark channel open R/W with process */
-    ch->flags = CHN_F_RD | CHN_F_WR | CHN_F_PROC;
+    if (ch->id == CHN_CMD || ch->id == CHN_MSG) {
+	mlpx_printf (CHN_MSG, MF_ERR, "cannot close channel %0*X\n",
+							mlpx_idlen(), ch->id);
+	return -1;
+    }
 
-    /* buffers, logfile, motd */
-    mlpx_setup_ch (ch);
+    close_chn (ch);
 
-    return 0;
+    return 0;	/* ok */
 }
 
 
 /*
- *	arg2chn()		[private]
+ *	cmdi_define()		[private]
  *
- *	convert (hex) string to channel,
- *	return 0 on failure.
+ *	define command, args:
+ *	channel definition like in the config file
+ *	(without the 'channel' keyword), e.g.
+ *	  define "name" { type "x" method { unix "/path" } }
  *
- *	(outputs error msgs on failure)
+ *	the new channel is announced on CHN_CMD, the
+ *	reply carries the new channel id (instead of the
+ *	first argument)
+ *
+ *	returns: 0 ok, -1 error
  */
-static chn_t *arg2chn (const char *s)
+static int cmdi_define (int ac, char *av[])
 {
-int id;
+static char idbuf[CHN_XIDLEN + 1];
+struct chnlist *chli;
 chn_t *ch;
 
-    /* (try to) get channel */
-    id = hexd2int (s[0]) * 16 + hexd2int (s[1]);
-    ch = mlpx_id2chn (id);
+    if (ac < 2) {
+	mlpx_printf (CHN_CMD, MF_ERR,
+				"missing channel definition for %s\n", av[0]);
+	return -1;
+    }
 
-    if (!ch) {
-	mlpx_printf (CHN_MSG, MF_ERR, "no such channel\n");
-	return 0;
+    /* parse the untokenized arguments (errors go to CHN_CMD) */
+    if (! (chli = conf_parse_channel (cmd_args))) {
+	mlpx_printf (CHN_CMD, MF_ERR, "invalid channel definition\n");
+	return -1;
     }
 
-    return ch;
+    if (! (ch = mlpx_new_chn (&chli->channel))) {
+	conf_free_channel (chli);
+	return -1;
+    }
+
+    /* report the id instead of the first arg */
+    snprintf (idbuf, sizeof idbuf, "%0*X", mlpx_idlen(), ch->id);
+    av[1] = idbuf;
+
+    return 0;	/* ok */
 }
 
 
 /*
- *	cmdi_open()		[private]
+ *	cmdi_undefine()		[private]
  *
- *	open command, args:
+ *	undefine command, args:
  *	1: channel id
  *
- *	returns: 0 ok, -1 error, -2 inprogress
+ *	the channel must be closed
+ *
+ *	returns: 0 ok, -1 error
  */
-static int cmdi_open (int ac, char *av[])
+static int cmdi_undefine (int ac, char *av[])
 {
-int r;
 chn_t *ch;
 
     if (ac < 2) {
@@ -406,208 +2660,256 @@ chn_t *ch;
     } else if (ac > 2)
 	mlpx_printf (CHN_MSG, 0, "extra args for command %s ignored\n", av[0]);
 
-    /* (try to) get channel to open */
+    /* (try to) get channel to remove */
     if (! (ch = arg2chn (av[1])))
 	return -1;
 
-    if ((ch->flags & CHN_F_ACT)) {
-	/* channel is already open */
-	mlpx_printf (CHN_MSG, MF_ERR, "channel %02X is already open\n",ch->id);
+    if (ch->id == CHN_CMD || ch->id == CHN_MSG) {
+	mlpx_printf (CHN_MSG, MF_ERR, "cannot undefine channel %0*X\n",
+							mlpx_idlen(), ch->id);
 	return -1;
     }
 
-    /* now jump to the method specific part */
-    switch (ch->cf->method.type) {
-	case mtUNIX:
-	    r = cmdi_open_UNIX (ch);
-	    break;
-
-	case mtINET:
-	    r = cmdi_open_INET (ch);
-	    break;
-
-	case mtPOPEN:
-	    r = cmdi_open_POPEN (ch);
-	    break;
-
-	case mtREAD:
-	case mtWRITE:
-	default:
-	    mlpx_printf (CHN_MSG, MF_ERR, "the access method defined for"
-				" this channel is not implemented, sorry\n");
-	    return -1;
+    if (ch->flags & (CHN_F_ACT | CHN_F_IP | CHN_F_PEND | CHN_F_RCW)) {
+	mlpx_printf (CHN_MSG, MF_ERR, "channel %0*X is open\n",
+							mlpx_idlen(), ch->id);
+	return -1;
     }
 
-    if (r == -2) {
-	/* we need an fdio in order be noticed by scheduler */
-	tesc_enq_wq (ch, 0);
-	tesc_keep (ch);
+    if (ch->pq) {
+	mlpx_printf (CHN_MSG, MF_ERR,
+			"channel %0*X has output pending, try again\n",
+							mlpx_idlen(), ch->id);
+	return -1;
+    }
 
-    } else if (r == -1)
-	mlpx_printf (CHN_MSG, MF_ERR, "open channel %s failed\n", av[1]);
+    if (ch->nacc) {
+	mlpx_printf (CHN_MSG, MF_ERR,
+			"channel %0*X has accepted connections\n",
+							mlpx_idlen(), ch->id);
+	return -1;
+    }
 
-    return r;	/* result from method specific part */
+    return mlpx_del_chn (ch);
 }
 
 
-/* data for reaper() */
-struct rdat {
-	pid_t	pid;
-	int	step;
-};
-
 /*
- *	reaper()		[private]
+ *	cmdi_send()		[private]
+ *
+ *	send command, args:
+ *	1: list of channels (see arg2chnlist())
+ *	the rest of the line is sent to all channels
  *
- *	timed event to terminate process and
- *	collect its exit status
+ *	the data is copied once and shared by the write
+ *	queues of all channels. nothing is sent if one of
+ *	the channels listed by id is not writeable, those
+ *	in ranges (or 'all') which are not are skipped.
+ *
+ *	returns: 0 ok, -1 error
  */
-static void reaper (timedev_t *me)
+static int cmdi_send (int ac, char *av[])
 {
-struct rdat *rd;
-pid_t pid;
-int status;
-int done;
-
-    done = 0;
-    status = 0;
-    rd = (struct rdat*) me->data;
-
-    /* always check if process terminated */
-    if ((pid = waitpid (rd->pid, &status, WNOHANG)) == -1) {
-	mlpx_printf (CHN_MSG, MF_ERR, "waitpid(): %s\n", strerror(errno));
-
-    } else if (pid) {
-	if (WIFSTOPPED(status)) {
-	    mlpx_printf (CHN_MSG, 0, "pid %u stopped\n", pid);
-	} else if (WIFSIGNALED(status)) {
-	    mlpx_printf (CHN_MSG, 0, "pid %u terminated by signal %d%s\n",
-				pid, WTERMSIG(status),
-				WCOREDUMP(status) ? " core dumped" : "");
-	    done = 1;
-        } else if (WIFEXITED(status)) {
-	    mlpx_printf (CHN_MSG, 0, "pid %u exited (%d)\n",
-						pid, WEXITSTATUS(status));
-	    done = 1;
-	} else {
-	    /* should not happen */
-	    mlpx_printf (CHN_MSG, MF_ERR, "unknown status code "
-					"0x%08x for pid %u\n", status, pid);
-	    done = 1; /* we ignore the pid from now on */
+int i, n, nw;
+size_t l;
+const char *text, *why;
+chn_t **chs;
+char *expl;
+msg_t *m, *s;
+
+    if (ac < 2) {
+	mlpx_printf (CHN_MSG, MF_ERR,
+				"missing channel argument for %s\n", av[0]);
+	return -1;
+    }
+
+    if ((n = arg2chnlist (av[1], &chs, &expl)) == -1)
+	return -1;
+
+    /* check all channels before sending anything */
+    for (i = 0, nw = 0; i < n; ++i) {
+	if (chs[i]->id == CHN_CMD || chs[i]->id == CHN_MSG)
+	    why = "command/message channel";
+	else if (chs[i]->flags & CHN_F_IP)
+	    why = "not yet ready";
+	else if (! (chs[i]->flags & CHN_F_WR))
+	    why = "not open for writing";
+	else {
+	    ++nw;
+	    continue;
+	}
+
+	if (expl[i]) {
+	    mlpx_printf (CHN_MSG, MF_ERR, "channel %0*X: %s\n",
+					mlpx_idlen(), chs[i]->id, why);
+	    break;
 	}
+	mlpx_printf (CHN_MSG, 0, "channel %0*X: %s, skipped\n",
+					mlpx_idlen(), chs[i]->id, why);
+	chs[i] = 0;
+    }
+    if (i < n || nw == 0) {
+	if (i == n)
+	    mlpx_printf (CHN_MSG, MF_ERR, "no channels to send to\n");
+	free (chs);
+	free (expl);
+	return -1;
     }
 
-    if (!done) {
-	/* process has not yet terminated */
+    /* the text is everything after the channel list */
+    text = cmd_args + strcspn (cmd_args, TOKSEP);
+    text += strspn (text, TOKSEP);
+    l = strlen (text);
+
+    m = sec_malloc (sizeof(msg_t) + l + 1);		/* may exit */
+    m->next = 0;
+    m->flags = MF_PLAIN;
+    m->len = l + 1;
+    m->refs = 0;
+    m->shr = 0;
+    memcpy (m->data, text, l);
+    m->data[l] = '\n';
+
+    /* one reference per channel, m is freed with the last one */
+    ++m->refs;		/* (keep it while sharing) */
+    for (i = 0; i < n; ++i) {
+	if (! chs[i])
+	    continue;
+	s = data_share_msg (m);				/* may exit */
+	if (tesc_enq_wq (chs[i], s)) {
+	    mlpx_printf (CHN_MSG, MF_ERR, "cannot queue data for "
+			"channel %0*X\n", mlpx_idlen(), chs[i]->id);
+	    data_free_msg (s);
+	    --nw;
+	}
+    }
+    if (--m->refs == 0)
+	free (m);		/* not queued anywhere */
 
-	switch (rd->step) {
-	    case 1:
-		mlpx_printf (CHN_MSG, 0, "sending SIGHUP to %u\n", rd->pid);
-		if (kill (rd->pid, SIGHUP) == -1) {	/* its /bin/sh */
-		    if (errno == ESRCH && pid != 0) {
-			/* process is gone */
-			me->inms = 100;
-			break;
-		    } else {
-			mlpx_printf (CHN_MSG, MF_ERR, "kill() pid %u: %s\n",
-						rd->pid, strerror(errno));
-		    }
-		}
+    free (chs);
+    free (expl);
 
-		/* try again in 10 seconds */
-		me->inms = 10000;
-		break;
+    return nw ? 0 : -1;
+}
 
-	    case 2:
-		mlpx_printf (CHN_MSG, 0, "sending SIGTERM to %u\n", rd->pid);
-		if (kill (rd->pid, SIGTERM) == -1) {
-		    if (errno == ESRCH && pid != 0) {
-			/* process is gone */
-			me->inms = 100;
-			break;
-		    } else {
-			mlpx_printf (CHN_MSG, MF_ERR, "kill() pid %u: %s\n",
-						rd->pid, strerror(errno));
-		    }
-		}
 
-		/* try again in 20 seconds */
-		me->inms = 20000;
-		break;
-		
-	    case 3:
-		mlpx_printf (CHN_MSG, 0, "sending SIGKILL to %u\n", rd->pid);
-		if (kill (rd->pid, SIGKILL) == -1) {
-		    if (errno == ESRCH && pid != 0) {
-			/* process is gone */
-			me->inms = 100;
-			break;
-		    } else {
-			mlpx_printf (CHN_MSG, MF_ERR, "kill() pid %u: %s\n",
-						rd->pid, strerror(errno));
-		    }
-		}
+/*
+ *	cmdi_link()		[private]
+ *
+ *	link command, args:
+ *	1: source channel
+ *	2: destination channel
+ *
+ *	input of the source channel is written to the
+ *	destination channel instead of the main output
+ *	(until unlink or one of them is closed)
+ *
+ *	returns: 0 ok, -1 error
+ */
+static int cmdi_link (int ac, char *av[])
+{
+chn_t *src, *dst;
 
-		/* fallthrough */
+    if (ac < 3) {
+	mlpx_printf (CHN_MSG, MF_ERR,
+				"missing channel argument for %s\n", av[0]);
+	return -1;
+    } else if (ac > 3)
+	mlpx_printf (CHN_MSG, 0, "extra args for command %s ignored\n", av[0]);
 
-	    default:
-		/* we already sent a KILL signal ... */
-		rd->step = 3;		/* incremented below */
-		me->inms = 10000;	/* check again every 10 seconds */
-		break;
-        }
+    if (! (src = arg2chn (av[1])) || ! (dst = arg2chn (av[2])))
+	return -1;
+
+    if (src->id == CHN_CMD || src->id == CHN_MSG ||
+				dst->id == CHN_CMD || dst->id == CHN_MSG) {
+	mlpx_printf (CHN_MSG, MF_ERR, "cannot link command/message channel\n");
+	return -1;
+    }
 
-	++rd->step;
+    if (src == dst) {
+	mlpx_printf (CHN_MSG, MF_ERR, "cannot link channel %0*X to itself\n",
+							mlpx_idlen(), src->id);
+	return -1;
+    }
 
-	/* reschedule with updated params */
-	tesc_timedev (me);
+    if (! (src->flags & CHN_F_RD)) {
+	mlpx_printf (CHN_MSG, MF_ERR,
+			"channel %0*X not open for reading\n",
+							mlpx_idlen(), src->id);
+	return -1;
+    }
 
-    } else {
-	(void) free (rd);
-	(void) free (me);
+    if ((dst->flags & CHN_F_IP) || ! (dst->flags & CHN_F_WR)) {
+	mlpx_printf (CHN_MSG, MF_ERR,
+			"channel %0*X not open for writing\n",
+							mlpx_idlen(), dst->id);
+	return -1;
     }
 
-    return;
+    if (src->link) {
+	mlpx_printf (CHN_MSG, MF_ERR, "channel %0*X already linked to %0*X\n",
+			mlpx_idlen(), src->id, mlpx_idlen(), src->link->id);
+	return -1;
+    }
+
+    if (dst->lsrc) {
+	mlpx_printf (CHN_MSG, MF_ERR, "channel %0*X already linked from %0*X\n",
+			mlpx_idlen(), dst->id, mlpx_idlen(), dst->lsrc->id);
+	return -1;
+    }
+
+    mlpx_link (src, dst);
+
+    return 0;	/* ok */
 }
 
 
 /*
- *	cmdi_inst_reaper()
+ *	cmdi_unlink()		[private]
  *
- *	install a timed event, which will 'wait()' the
- *	specified pid and, use signals if it refuses to die.
+ *	unlink command, args:
+ *	1: source channel of a link
  *
- *	[ this does not actually belong here as a 'cmdi_' func ]
+ *	returns: 0 ok, -1 error
  */
-void cmdi_inst_reaper (pid_t pid)
+static int cmdi_unlink (int ac, char *av[])
 {
-timedev_t *te;
-struct rdat *rd;
+chn_t *ch;
 
-    te = sec_malloc (sizeof *te);		/* may exit */
-    rd = sec_malloc (sizeof *rd);		/* may exit */
+    if (ac < 2) {
+	mlpx_printf (CHN_MSG, MF_ERR,
+				"missing channel argument for %s\n", av[0]);
+	return -1;
+    } else if (ac > 2)
+	mlpx_printf (CHN_MSG, 0, "extra args for command %s ignored\n", av[0]);
 
-    te->inms = 1000;
-    te->func = reaper;
-    te->data = rd;
-    rd->pid  = pid;
-    rd->step = 1;
+    if (! (ch = arg2chn (av[1])))
+	return -1;
 
-    tesc_timedev (te);
+    if (! ch->link) {
+	mlpx_printf (CHN_MSG, MF_ERR, "channel %0*X is not linked\n",
+							mlpx_idlen(), ch->id);
+	return -1;
+    }
 
-    return;
+    mlpx_unlink (ch);
+
+    return 0;	/* ok */
 }
 
 
 /*
- *	cmdi_close()		[private]
+ *	cmdi_stat()		[private]
  *
- *	open command, args:
- *	1: channel id
+ *	stat command, args:
+ *	1: channel
+ *
+ *	prints the traffic counters of the channel
+ *	(bytes read from / written to its fd)
  *
  *	returns: 0 ok, -1 error
  */
-static int cmdi_close (int ac, char *av[])
+static int cmdi_stat (int ac, char *av[])
 {
 chn_t *ch;
 
@@ -618,35 +2920,24 @@ chn_t *ch;
     } else if (ac > 2)
 	mlpx_printf (CHN_MSG, 0, "extra args for command %s ignored\n", av[0]);
 
-    /* (try to) get channel to close */
     if (! (ch = arg2chn (av[1])))
 	return -1;
 
-    if (! (ch->flags & (CHN_F_ACT | CHN_F_IP))) {
-	/* channel is not open */
-	mlpx_printf (CHN_MSG, MF_ERR, "channel %02X is not open\n", ch->id);
-	return -1;
-    }
-
-    if (ch->id == CHN_CMD || ch->id == CHN_MSG) {
-	mlpx_printf (CHN_MSG, MF_ERR, "cannot close channel %02X\n", ch->id);
-	return -1;
-    }
-
-    /***
-     *** FIXME: we should check if the output queue is empty
-     *** and wait for it to drain (unless forced - 'close -f', or
-     *** perhaps issue a second close command to force it)
-     ***/
-
-    /* close/free */
-    (void) close (ch->fd);
+    if (ch->link)
+	cmdi_reply (cmd_tag, "STAT %0*X in %lu out %lu link %0*X\n",
+			mlpx_idlen(), ch->id, ch->nrd, ch->nwr,
+			mlpx_idlen(), ch->link->id);
+    else
+	cmdi_reply (cmd_tag, "STAT %0*X in %lu out %lu\n",
+			mlpx_idlen(), ch->id, ch->nrd, ch->nwr);
 
-    if (ch->flags & CHN_F_PROC)
-	cmdi_inst_reaper (ch->pid);
+    if (ch->fst)
+	cmdi_reply (cmd_tag, "STAT %0*X lines %lu passed %lu dropped\n",
+			mlpx_idlen(), ch->id, ch->fst->npass, ch->fst->ndrop);
 
-    if (ch->flags & CHN_F_ACT)
-	mlpx_cleanup_ch (ch);
+    if (ch->log != -1 && logw_dropped (ch->log))
+	cmdi_reply (cmd_tag, "STAT %0*X log %lu dropped\n",
+			mlpx_idlen(), ch->id, logw_dropped (ch->log));
 
     return 0;	/* ok */
 }
@@ -679,8 +2970,6 @@ static int cmdi_quit (int ac, char *av[])
 }
 
 
-#define TOKSEP " \t"		/* command input token seperator */
-
 /* return value for build_av() */
 struct avret {
 	int	ac;		/* total number of tokens */
@@ -730,8 +3019,8 @@ char buf[8];
     if (orn.revents & POLLIN) {
 
 	if (read (orn.ch->fd, buf, 0) == -1) {
-	    mlpx_printf (CHN_CMD, MF_ERR, "open %02X: open(): %s\n",
-						orn.ch->id, strerror(errno));
+	    mlpx_printf (CHN_CMD, MF_ERR, "open %0*X: open(): %s\n",
+				mlpx_idlen(), orn.ch->id, strerror(errno));
 	    return -1;
 	} else
 	    return 0;
@@ -739,8 +3028,8 @@ char buf[8];
     } else if (orn.revents & POLLOUT) {
 
 	if (write (orn.ch->fd, buf, 0) == -1) {
-	    mlpx_printf (CHN_CMD, MF_ERR, "open %02X: open(): %s\n",
-						orn.ch->id, strerror(errno));
+	    mlpx_printf (CHN_CMD, MF_ERR, "open %0*X: open(): %s\n",
+				mlpx_idlen(), orn.ch->id, strerror(errno));
 	    return -1;
 	} else
 	    return 0;
@@ -769,14 +3058,14 @@ socklen_t el;
     e = 0;
     el = sizeof e;
     if (getsockopt (orn.ch->fd, SOL_SOCKET, SO_ERROR, &e, &el) == -1) {
-	mlpx_printf (CHN_CMD, MF_ERR, "open %02X: getsockopt(): %s\n",
-						orn.ch->id, strerror(errno));
+	mlpx_printf (CHN_CMD, MF_ERR, "open %0*X: getsockopt(): %s\n",
+				mlpx_idlen(), orn.ch->id, strerror(errno));
 	return -1;	/* cannot determine result -> fail */
     }
 
     if (e) {	/* connect failed */
-	mlpx_printf (CHN_CMD, MF_ERR, "open %02X: connect(): %s\n",
-						orn.ch->id, strerror(e));
+	mlpx_printf (CHN_CMD, MF_ERR, "open %0*X: connect(): %s\n",
+					mlpx_idlen(), orn.ch->id, strerror(e));
 	return -1;	/* connect failed */
     }
 
@@ -793,6 +3082,7 @@ socklen_t el;
 static void cmdi_handle_ntf (orn_t orn)
 {
 int res;
+chn_t *ch;
 
     if (orn.ch->flags & CHN_F_OIP)		/* it was an open() call */
 	res = cmdi_handle_oip (orn);
@@ -807,10 +3097,15 @@ int res;
 	res = -1;
     }
 
+    if (orn.ch->iop) {
+	/* one of several connect attempts for an inet channel */
+	ch = orn.ch->iop->ch;
+	open_report (ch, he_notify (orn.ch, res));
+	return;
+    }
+
     if (res == -1) {
 	/* handle open/connect failure */
-	mlpx_printf (CHN_CMD, 0, "FAIL open %02X\n", orn.ch->id);
-
 	(void) close (orn.ch->fd);
 	mlpx_cleanup_ch (orn.ch);
 
@@ -818,10 +3113,10 @@ int res;
 	/* finish channel setup */
 	orn.ch->flags &= ~CHN_F_IP;
 	mlpx_setup_ch (orn.ch);
-
-	mlpx_printf (CHN_CMD, 0, "OK open %02X\n", orn.ch->id);
     }
 
+    open_report (orn.ch, res);
+
     return;
 }
 
@@ -843,6 +3138,8 @@ char *tok;
 struct avret r;
 int i, v;
 cmd_fun func = 0;
+char *args;
+size_t l;
 
     /* prepare m for strtok() - replace \n with \0 */
     if (m->data[m->len - 1] != '\n') {
@@ -857,8 +3154,48 @@ cmd_fun func = 0;
     if (!m->data[0])
 	return;
 
+    /* keep a copy of the (untokenized) args for the command */
+    l = strspn (m->data, TOKSEP);
+    if (m->data[l] == '@') {
+	/* skip request tag */
+	l += strcspn (m->data + l, TOKSEP);
+	l += strspn (m->data + l, TOKSEP);
+    }
+    l += strcspn (m->data + l, TOKSEP);
+    l += strspn (m->data + l, TOKSEP);
+    args = sec_malloc (m->len - l);			/* may exit */
+    strcpy (args, m->data + l);
+    cmd_args = args;
+
     /* tokenize the message */
-    tok = strtok (m->data, TOKSEP);
+    if (! (tok = strtok (m->data, TOKSEP))) {
+	/* ignore lines containing only white space */
+	cmd_args = 0;
+	free (args);
+	return;
+    }
+
+    /* optional request tag, echoed in all replies */
+    if (*tok == '@') {
+	if (strlen (tok) > CMD_TAGMAX) {
+	    mlpx_printf (CHN_CMD, MF_ERR, "request tag too long "
+					"(max %d chars)\n", CMD_TAGMAX);
+	    cmdi_reply (0, "FAIL\n");
+	    cmd_args = 0;
+	    free (args);
+	    return;
+	}
+	cmd_tag = tok;
+	if (! (tok = strtok (0, TOKSEP))) {
+	    mlpx_printf (CHN_CMD, MF_ERR, "missing command after %s\n",
+								cmd_tag);
+	    cmdi_reply (cmd_tag, "FAIL\n");
+	    cmd_args = 0;
+	    cmd_tag = 0;
+	    free (args);
+	    return;
+	}
+    }
     r = build_av (1);
     r.av[0] = tok;
 
@@ -875,22 +3212,24 @@ cmd_fun func = 0;
 	switch ((v = func (r.ac, r.av))) {
 	    case -2:
 		if (r.ac > 1)
-		    mlpx_printf (CHN_CMD, 0, "WAIT %s %s\n", r.av[0], r.av[1]);
+		    cmdi_reply (cmd_tag, "WAIT %s %s\n", r.av[0], r.av[1]);
 		else
-		    mlpx_printf (CHN_CMD, 0, "WAIT %s\n", r.av[0]);
+		    cmdi_reply (cmd_tag, "WAIT %s\n", r.av[0]);
 		break;
 	    case -1:
 		if (r.ac > 1)
-		    mlpx_printf (CHN_CMD, 0, "FAIL %s %s\n", r.av[0], r.av[1]);
+		    cmdi_reply (cmd_tag, "FAIL %s %s\n", r.av[0], r.av[1]);
 		else
-		    mlpx_printf (CHN_CMD, 0, "FAIL %s\n", r.av[0]);
+		    cmdi_reply (cmd_tag, "FAIL %s\n", r.av[0]);
 		break;
 	    case 0:
 		if (r.ac > 1)
-		    mlpx_printf (CHN_CMD, 0, "OK %s %s\n", r.av[0], r.av[1]);
+		    cmdi_reply (cmd_tag, "OK %s %s\n", r.av[0], r.av[1]);
 		else
-		    mlpx_printf (CHN_CMD, 0, "OK %s\n", r.av[0]);
+		    cmdi_reply (cmd_tag, "OK %s\n", r.av[0]);
 		break;
+	    case 1:
+		break;	/* result already sent by the command */
 	    default:
 		mlpx_printf (CHN_MSG, MF_ERR, "cmdi_cmd(): "
 				"invalid command return value %d\n", v);
@@ -900,9 +3239,14 @@ cmd_fun func = 0;
     } else {
 	/* unknown command / syntax error */
 	mlpx_printf (CHN_CMD, MF_ERR, "unknown command: %s\n", r.av[0]);
-	mlpx_printf (CHN_CMD, 0, "FAIL %s\n", r.av[0]);
+	cmdi_reply (cmd_tag, "FAIL %s\n", r.av[0]);
     }
 
+    cmd_args = 0;
+    cmd_tag = 0;
+    free (args);
+    free (r.av);
+
     return;
 }
 
@@ -926,12 +3270,12 @@ void *tmp;
      */
 
     while (orn_list) {
-	/* handle notification */
-	cmdi_handle_ntf (orn_list->orn);
-
-	/* next one (if any), free this notification */
+	/* next one (if any), handling may remove others */
 	tmp = orn_list;
 	orn_list = orn_list->next;
+
+	/* handle notification, free it */
+	cmdi_handle_ntf (((struct ornli *) tmp)->orn);
 	free (tmp);
     }
 
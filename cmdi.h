@@ -39,7 +39,10 @@ typedef struct {
 extern void cmdi_enque (msg_t *);
 extern void cmdi_cmd();
 extern void cmdi_notify (orn_t);
-extern void cmdi_inst_reaper (pid_t);
+extern void cmdi_reconnect (chn_t *);
+extern void cmdi_pool_fill (chn_t *);
+extern void cmdi_pool_free (chn_t *);
+extern void cmdi_pool_reap (void);
 
 
 #endif /* ! CMDI_H */
@@ -27,6 +27,9 @@
  *	definitions for config (file) parsing / config usage
  */
 
+#include <sys/types.h>
+#include <regex.h>
+
 
 #ifndef UT_CONFIG_PATH
 #define	UT_CONFIG_PATH		"ut.conf"
@@ -40,6 +43,12 @@
 #define UT_TIMEOUT	0	/* off */
 #endif
 
+#ifndef UT_CTIMEOUT
+#define UT_CTIMEOUT	30	/* connect/open timeout (s) */
+#endif
+
+#define UT_POOLMAX	16	/* max idle processes per channel */
+
 
 /* (internally obsolete) channel types - 	*/
 /*	       can still be specified in config	*/
@@ -57,7 +66,11 @@ typedef enum {
 	mtINET,				/* inet socket			*/
 	mtPOPEN,			/* stdin/stdout of a process	*/
 	mtREAD,				/* file (-system object) read	*/
-	mtWRITE				/* file (-system object) write	*/
+	mtWRITE,			/* file (-system object) write	*/
+	mtFOLLOW,			/* file, like 'tail -F'		*/
+	mtUDP,				/* udp socket			*/
+	mtLUNIX,			/* listening unix socket	*/
+	mtLINET				/* listening inet socket	*/
 } mt_type_t;
 
 struct strlist {
@@ -71,13 +84,59 @@ struct method {
 	int		data;		/* flags, port #, ...		*/
 };
 
+/* method flags (popen) */
+#define MT_F_EXEC	0x1		/* exec command, no /bin/sh	*/
+#define MT_F_PTY	0x2		/* on a pseudo terminal		*/
+
+/* method flags (unix) */
+#define MT_F_DGRAM	0x4		/* SOCK_DGRAM			*/
+#define MT_F_SEQPKT	0x8		/* SOCK_SEQPACKET		*/
+
+struct pattern {
+	struct pattern	*next;		/* next item (0 == end of list)	*/
+	const char	*str;		/* pattern as in config		*/
+	regex_t		re;		/* compiled pattern		*/
+};
+
+struct filter {
+	struct pattern	*incl;		/* pass lines matching these	*/
+	struct pattern	*excl;		/* drop lines matching these	*/
+	int		head;		/* pass first n lines (or 0)	*/
+	int		sample;		/* pass every n-th line (or 0)	*/
+	int		rate;		/* max lines per second (or 0)	*/
+};
+
+struct sockopt {
+	int		rcvbuf;		/* SO_RCVBUF (or 0)		*/
+	int		sndbuf;		/* SO_SNDBUF (or 0)		*/
+	int		nodelay;	/* TCP_NODELAY			*/
+	int		keepidle;	/* TCP_KEEPIDLE, s (or 0)	*/
+	int		keepintvl;	/* TCP_KEEPINTVL, s (or 0)	*/
+	int		keepcnt;	/* TCP_KEEPCNT (or 0)		*/
+	int		usertimeout;	/* TCP_USER_TIMEOUT, ms (or 0)	*/
+	int		busypoll;	/* SO_BUSY_POLL, us (or 0)	*/
+};
+
 struct channel {
 	int		enabled;	/* parser internal use		*/
+	int		rtdef;		/* defined at runtime		*/
 	const char	*name;		/* channel name/label		*/
 	const char	*log;		/* path to channel log file	*/
 	struct strlist	*msg;		/* channel spec. startup msg	*/
 	const char	*type;		/* 'what is on the other end'	*/
 	struct method	method;		/* 'transport' spec		*/
+	struct filter	*filter;	/* input line filter (or 0)	*/
+	int		prio;		/* priority class (0: default)	*/
+	int		weight;		/* weight in class (0: default)	*/
+	int		rlbytes;	/* max bytes per second (or 0)	*/
+	int		rllines;	/* max lines per second (or 0)	*/
+	int		rcdelay;	/* reconnect delay, ms (or 0)	*/
+	int		rcmax;		/* max reconnect delay, ms	*/
+	int		rctries;	/* max # of attempts (or 0)	*/
+	int		ctimeout;	/* open timeout, s (0: default)	*/
+	int		pool;		/* # of idle processes (popen)	*/
+	int		autoopen;	/* open when the socket appears	*/
+	struct sockopt	*sockopt;	/* socket options (or 0)	*/
 };
 
 struct chnlist {
@@ -92,11 +151,15 @@ struct config {
 	struct chnlist	*channels;	/* list of channel configs	*/
 	int		keepalive;	/* keepalive interval (or 0)	*/
 	int		timeout;	/* timeout (0: disable)		*/
+	int		ctimeout;	/* default open timeout (s)	*/
 };
 
 
 extern void *sec_malloc (size_t);
+extern void *sec_realloc (void *, size_t);
 extern const struct config *conf_init (int);
+extern struct chnlist *conf_parse_channel (const char *);
+extern void conf_free_channel (struct chnlist *);
 
 
 #endif /* ! CONF_H */
@@ -25,9 +25,15 @@
  *	buffer related stuff
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE		/* recvmmsg() */
+#endif
+
 #include <stdio.h>	/* FIXME */
 #include <stdlib.h>
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
@@ -38,6 +44,11 @@
 #include "tesc.h"
 
 
+#define	DGRAM_BATCH	16		/* max datagrams per recvmmsg()	*/
+#define	DGRAM_MAX	0x10000		/* max datagram size		*/
+#define	FILE_CHUNK	0x40000		/* pread() size for files	*/
+
+
 /*
  *	new_sbuf()	-- allocate and initialize struct sbuf
  *	[private]
@@ -76,7 +87,9 @@ msg_t *m;
     m->next = 0;
     m->flags = 0;
     m->len = 0;	/* actual size is 'dsiz', but data is not yet init'ed */
-    for (i = 0; i < PRFXLEN; ++i)
+    m->refs = 0;
+    m->shr = 0;
+    for (i = 0; i < PRFXMAX; ++i)
 	m->prefix[i] = 0;
     /* data is left uninitialized */
 
@@ -113,7 +126,7 @@ int rff = 0;
     m = new_msg (dlen);				/* may exit */
 
     sb = b->sbh;
-    to = flags & MF_PLAIN ? m->data : m->prefix;
+    to = flags & MF_PLAIN ? m->data : m->data - PRFXLEN;
 
     /* copy the data (and free emptied buffers) */
     for (i = 0, from = sb->fdata; i < len; ++i) {
@@ -280,6 +293,9 @@ int l;
 
     /* do a maximum size read */
     if ((l = read (fd, b->cur->ffree, b->cur->flen)) == -1) {
+	if (errno == EIO)
+	    return -2;	/* pty master: all slave fds are closed */
+
 	/*
 	 * read error on 'fd' -- since we should have come here
 	 * from a successful poll() for 'fd' this probably means
@@ -295,6 +311,8 @@ int l;
 	return -2;
     }
 
+    ch->nrd += l;
+
     /* adjust the buffer params accordingly */
     b->cur->ffree += l;
     b->cur->flen -= l;
@@ -306,6 +324,188 @@ int l;
 }
 
 
+/*
+ *	data_dgram_input()
+ *
+ *	read pending datagrams from 'fd' (batched with recvmmsg()
+ *	where available), each one becomes exactly one msg (line):
+ *	a '\n' inside is sent as "\n" (and '\' as "\\"), a
+ *	missing one at the end is added. 'b' is only used for its
+ *	output function.
+ *
+ *	retval like data_buf_input()
+ */
+int data_dgram_input (int fd, buf_t *b, chn_t *ch)
+{
+static char dbuf[DGRAM_BATCH][DGRAM_MAX];
+struct iovec iov[DGRAM_BATCH];
+#ifdef __linux__
+struct mmsghdr mh[DGRAM_BATCH];
+#endif
+int lens[DGRAM_BATCH], trunc[DGRAM_BATCH];
+int i, j, n, l, fl, esc;
+char *p;
+msg_t *m;
+
+    for (i = 0; i < DGRAM_BATCH; ++i) {
+	iov[i].iov_base = dbuf[i];
+	iov[i].iov_len = DGRAM_MAX;
+    }
+
+#ifdef __linux__
+    memset (mh, 0, sizeof(mh));
+    for (i = 0; i < DGRAM_BATCH; ++i) {
+	mh[i].msg_hdr.msg_iov = &iov[i];
+	mh[i].msg_hdr.msg_iovlen = 1;
+    }
+    n = recvmmsg (fd, mh, DGRAM_BATCH, MSG_DONTWAIT, 0);
+    for (i = 0; i < n; ++i) {
+	lens[i] = mh[i].msg_len;
+	trunc[i] = mh[i].msg_hdr.msg_flags & MSG_TRUNC;
+    }
+#else
+    for (n = 0; n < DGRAM_BATCH; ++n) {
+	if ((l = recv (fd, dbuf[n], DGRAM_MAX, MSG_DONTWAIT)) == -1)
+	    break;
+	lens[n] = l;
+	trunc[n] = 0;
+    }
+    if (!n)
+	n = -1;
+#endif
+
+    if (n == -1) {
+	if (errno == EAGAIN || errno == EINTR)
+	    return 0;
+	mlpx_printf (ch->id, MF_ERR, "recv(): %s\n", strerror(errno));
+	return -1;
+    }
+
+    for (i = 0; i < n; ++i) {
+	if ((l = lens[i]) == 0) {
+	    /* stream like: peer closed, dgram: just empty */
+	    if (ch->cf->method.type == mtUNIX &&
+				(ch->cf->method.data & MT_F_SEQPKT))
+		return -2;
+	    continue;
+	}
+
+	if (trunc[i])
+	    mlpx_printf (ch->id, MF_ERR, "datagram truncated\n");
+
+	ch->nrd += l;
+
+	/* newline at the end is the terminator, not data */
+	fl = MF_PLAIN;
+	if (dbuf[i][l - 1] == '\n')
+	    --l;
+	else
+	    fl |= MF_NONL;
+
+	/* keep it one line: '\n' -> "\n", '\' -> "\\" */
+	for (j = 0, esc = 0; j < l; ++j)
+	    if (dbuf[i][j] == '\n' || dbuf[i][j] == '\\')
+		++esc;
+
+	m = new_msg (l + esc + 1);			/* may exit */
+	for (j = 0, p = m->data; j < l; ++j)
+	    if (dbuf[i][j] == '\n') {
+		*p++ = '\\';
+		*p++ = 'n';
+	    } else if (dbuf[i][j] == '\\') {
+		*p++ = '\\';
+		*p++ = '\\';
+	    } else
+		*p++ = dbuf[i][j];
+	*p++ = '\n';
+	m->len = p - m->data;
+	m->flags = fl;
+
+	if (ch->log != -1)
+	    tesc_log (m, ch, LOG_DIR_IN);
+
+	b->out (m, ch);
+    }
+
+    return 0;
+}
+
+
+/*
+ *	file_msg()	-- output 'len' bytes at 'p' as one msg
+ *	[private]	   (fragment w/o '\n' if MF_NONL is set)
+ */
+static void file_msg (buf_t *b, chn_t *ch, const char *p, size_t len,
+								int flags)
+{
+msg_t *m;
+
+    m = new_msg (flags & MF_NONL ? len + 1 : len);	/* may exit */
+    memcpy (m->data, p, len);
+    if (flags & MF_NONL)
+	m->data[len++] = '\n';
+    m->len = len;
+    m->flags = MF_PLAIN | flags;
+
+    if (ch->log != -1)
+	tesc_log (m, ch, LOG_DIR_IN);
+
+    b->out (m, ch);
+
+    return;
+}
+
+
+/*
+ *	data_file_input()
+ *
+ *	input function for the read method: read a large chunk of
+ *	the file at 'ch->roff' with one pread() and cut it into lines
+ *	right there (no sub buffers). an incomplete line at the end
+ *	is read again with the next chunk (unless it fills the whole
+ *	chunk or the file ends there). the caller paces the calls
+ *	by the main output.
+ *
+ *	if 'fd' cannot pread() (e.g. a fifo), data_buf_input() is used
+ *
+ *	retval like data_buf_input()
+ */
+int data_file_input (int fd, buf_t *b, chn_t *ch)
+{
+static char fbuf[FILE_CHUNK];
+char *p, *nl, *end;
+ssize_t l;
+
+    if ((l = pread (fd, fbuf, sizeof fbuf, ch->roff)) == -1) {
+	if (errno == ESPIPE)
+	    return data_buf_input (fd, b, ch);
+	if (errno == EAGAIN || errno == EINTR)
+	    return 0;
+	mlpx_printf (ch->id, MF_ERR, "pread(): %s\n", strerror(errno));
+	return -1;
+    }
+
+    if (l == 0)
+	return -2;	/* end of file */
+
+    /* complete lines */
+    end = fbuf + l;
+    for (p = fbuf; p < end && (nl = memchr (p, '\n', end - p)); p = nl + 1)
+	file_msg (b, ch, p, nl + 1 - p, 0);
+
+    /* a line longer than the chunk, or the last one w/o '\n' */
+    if (p == fbuf || (p < end && l < (ssize_t) sizeof fbuf)) {
+	file_msg (b, ch, p, end - p, MF_NONL);
+	p = end;
+    }
+
+    ch->nrd += p - fbuf;
+    ch->roff += p - fbuf;
+
+    return 0;
+}
+
+
 /*
  *	data_new_buf()
  *
@@ -350,4 +550,48 @@ struct sbuf *sbp, *tmp;
 }
 
 
+/*
+ *	data_share_msg()
+ *
+ *	return a new msg_t referring to the data of 'm',
+ *	e.g., to enqueue the same data for several channels.
+ *	'm' must not be queued itself and must not be freed
+ *	directly once shared - it is freed together with
+ *	the last msg referring to it (see data_free_msg()).
+ */
+msg_t *data_share_msg (msg_t *m)
+{
+msg_t *s;
+
+    s = sec_malloc (sizeof(msg_t));			/* may exit */
+
+    s->next = 0;
+    s->flags = MF_SHARED | (m->flags & MF_PLAIN);
+    s->len = m->len;
+    s->refs = 0;
+    s->shr = m;
+
+    ++m->refs;
+
+    return s;
+}
+
+
+/*
+ *	data_free_msg()
+ *
+ *	free a msg_t, including shared data if this
+ *	was the last msg referring to it
+ */
+void data_free_msg (msg_t *m)
+{
+    if ((m->flags & MF_SHARED) && --m->shr->refs == 0)
+	free (m->shr);
+
+    free (m);
+
+    return;
+}
+
+
 /*** end ***/
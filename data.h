@@ -27,19 +27,22 @@
  *	buffer related stuff
  */
 
-/* needs <sys/time.h> */
+/* needs <sys/time.h>, "mlpx.h" */
 
 
 #define SBISIZ		0x2000			/* sub buffer size	*/
 			/* actually less (- sizeof(struct sbuf))	*/
 #define	SBIMIN		80			/* min read size	*/
-#define	PRFXLEN		5			/* prefix length	*/
+#define	PRFXMAX		(CHN_XIDLEN + 3)	/* max prefix length	*/
+#define	PRFXLEN		(mlpx_idlen() + 3)	/* prefix length	*/
 
 /* flags used in msg_t */
 #define	MF_PLAIN	0x01			/* ignore prefix	*/
 #define	MF_NONL		0x02			/* incomplete line	*/
 #define MF_ERR		0x04			/* is error msg		*/
 #define MF_EOF		0x08			/* close down message	*/
+#define MF_SHARED	0x10			/* data is in 'shr'	*/
+#define MF_SPLICE	0x20			/* data is in link pipe	*/
 
 
 typedef struct buf_ buf_t;
@@ -87,14 +90,28 @@ struct msg_ {
 	int		flags;			/* PLAIN, NONL, 0	*/
 	int		len;			/* data len (including	*/
 						/*    prefix if !PLAIN) */
-	char		prefix[PRFXLEN];	/* prefix and data MUST	*/
+	int		refs;			/* # of sharing msgs	*/
+	msg_t		*shr;			/* msg holding the data	*/
+						/*    (if SHARED)	*/
+	char		prefix[PRFXMAX];	/* prefix and data MUST	*/
 	char		data[];			/*    be continuous!	*/
 };
 
+/* msg actually holding the data */
+#define MSG_BASE(m)	((m)->flags & MF_SHARED ? (m)->shr : (m))
+
+/* start of msg (prefix is right aligned in 'prefix', if present) */
+#define MSG_HEAD(m)	(MSG_BASE(m)->flags & MF_PLAIN ? MSG_BASE(m)->data : \
+					MSG_BASE(m)->data - PRFXLEN)
+
 
 extern int data_buf_input (int, buf_t*, chn_t*);
+extern int data_dgram_input (int, buf_t*, chn_t*);
+extern int data_file_input (int, buf_t*, chn_t*);
 extern buf_t *data_new_buf (bfofun_t, int, int);
 extern void data_del_buf (buf_t *b);
+extern msg_t *data_share_msg (msg_t *);
+extern void data_free_msg (msg_t *);
 
 
 #endif /* ! DATA_H */
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2026 bytemine GmbH <info@bytemine.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ *	ut: filt.c
+ *
+ *	per channel line filters
+ *
+ *	the filter is applied to each line (message) read from
+ *	a channel before it is passed to mux (or a linked channel):
+ *
+ *	- include: if any, line must match one of the patterns
+ *	- exclude: line must not match any of the patterns
+ *	- head n: only the first n selected lines pass
+ *	- sample n: only every n-th selected line passes
+ *	- rate n: at most n lines per second pass
+ *
+ *	the patterns are compiled when the config is parsed
+ *
+ *	only complete lines are filtered: the caller joins the
+ *	fragments of a line (up to FILT_PARTMAX bytes, a longer
+ *	one is decided on its start, and the rest follows that)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <regex.h>
+#include <string.h>
+#include <time.h>
+
+#include "conf.h"
+#include "filt.h"
+
+
+/*
+ *	filt_reset()
+ *
+ *	reset filter state (on open)
+ */
+void filt_reset (struct filtst *fs)
+{
+    fs->nsel = 0;
+    fs->npass = 0;
+    fs->ndrop = 0;
+    fs->rsec = 0;
+    fs->rcnt = 0;
+    fs->cont = 0;
+    fs->plen = 0;
+
+    return;
+}
+
+
+/*
+ *	match()		[private]
+ *
+ *	check if 's' matches any of the patterns in 'pl'
+ */
+static int match (const struct pattern *pl, const char *s)
+{
+    for (; pl; pl = pl->next)
+	if (! regexec (&pl->re, s, 0, 0, 0))
+	    return 1;
+
+    return 0;
+}
+
+
+/*
+ *	select_line()	[private]
+ *
+ *	apply include/exclude patterns to line 'd' (length 'len',
+ *	not 0 terminated, usually ending in '\n' which is not
+ *	part of the line for matching)
+ */
+static int select_line (const struct filter *f, char *d, size_t len)
+{
+char *s, c = 0;
+int r;
+
+    if (!f->incl && !f->excl)
+	return 1;
+
+    if (len && d[len - 1] == '\n') {
+	/* terminate in place (temporarily) */
+	s = d;
+	c = d[--len];
+	d[len] = 0;
+    } else {
+	s = sec_malloc (len + 1);			/* may exit */
+	memcpy (s, d, len);
+	s[len] = 0;
+    }
+
+    r = (!f->incl || match (f->incl, s)) && !match (f->excl, s);
+
+    if (s == d)
+	d[len] = c;
+    else
+	free (s);
+
+    return r;
+}
+
+
+/*
+ *	filt_line()
+ *
+ *	returns 1 if the line should be passed, 0 if it
+ *	should be dropped
+ */
+int filt_line (const struct filter *f, struct filtst *fs, char *d, size_t len)
+{
+time_t now;
+int pass = 0;
+
+    if (select_line (f, d, len)) {
+	++fs->nsel;
+
+	if (f->head && fs->nsel > (unsigned long) f->head)
+	    ;				/* beyond head */
+	else if (f->sample && (fs->nsel - 1) % f->sample)
+	    ;				/* not sampled */
+	else if (f->rate) {
+	    now = time (0);
+	    if (now != fs->rsec) {
+		fs->rsec = now;
+		fs->rcnt = 0;
+	    }
+	    if (fs->rcnt < f->rate) {
+		++fs->rcnt;
+		pass = 1;
+	    }
+	} else
+	    pass = 1;
+    }
+
+    if (pass)
+	++fs->npass;
+    else
+	++fs->ndrop;
+
+    return pass;
+}
+
+
+/*** end ***/
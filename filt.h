@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2026 bytemine GmbH <info@bytemine.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef FILT_H
+#define FILT_H
+/*
+ *	ut: filt.h
+ *
+ *	per channel line filters (between input buffer and mux)
+ */
+
+
+#define FILT_PARTMAX	0x2000		/* max incomplete line kept		*/
+
+/* runtime state of a channel filter (config is in struct filter) */
+struct filtst {
+	unsigned long	nsel;		/* # of lines selected (incl/excl)	*/
+	unsigned long	npass;		/* # of lines passed			*/
+	unsigned long	ndrop;		/* # of lines dropped			*/
+	time_t		rsec;		/* current second for 'rate'		*/
+	int		rcnt;		/* # of lines passed in 'rsec'		*/
+	int		cont;		/* rest of line: pass (1), drop (-1)	*/
+	size_t		plen;		/* # of bytes in 'part'			*/
+	char		part[FILT_PARTMAX];	/* start of an incomplete line	*/
+};
+
+
+extern void filt_reset (struct filtst *);
+extern int filt_line (const struct filter *, struct filtst *,
+						char *, size_t);
+
+
+#endif /* ! FILT_H */
@@ -0,0 +1,503 @@
+/*
+ * Copyright (c) 2026 bytemine GmbH <info@bytemine.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ *	ut: fwat.c
+ *
+ *	file watching, follow method
+ *
+ *	a watch calls its function whenever the file at 'path'
+ *	(or whatever file is there now) may have changed. with
+ *	inotify, the directory of the file is watched for its
+ *	name and the file itself (by inode) for modifications.
+ *	the events are read by the scheduler through a fake
+ *	channel. without inotify, the function is simply called
+ *	every FWAT_POLL ms.
+ *
+ *	a follow channel reads a file like 'tail -F': from its
+ *	end on, waiting at EOF (input on hold) until the file
+ *	changes. truncation and rotation (a new file with the
+ *	same name, switched to once the old one is read up
+ *	to its end) are handled at EOF, see fwat_eof().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "conf.h"
+#include "mlpx.h"
+#include "data.h"
+#include "tesc.h"
+#include "fwat.h"
+
+
+#define FWAT_POLL	1000		/* ms, without inotify		*/
+
+#ifdef __linux__
+#define FWAT_INOTIFY
+
+/* what we want to know about the directory / the file */
+#define FWAT_DMASK	(IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+#define FWAT_FMASK	(IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+#endif
+
+
+struct fwat {
+	struct fwat	*next;
+	char		*path;		/* watched file			*/
+	const char	*base;		/* its name (in 'path')		*/
+	fwatfun_t	fun;		/* called on changes		*/
+	void		*data;		/* client data for 'fun'	*/
+#ifdef FWAT_INOTIFY
+	int		dwd;		/* watch for the dir (or -1)	*/
+	int		fwd;		/* watch for the file (or -1)	*/
+	int		fired;		/* change seen			*/
+#else
+	timedev_t	te;		/* poll timer			*/
+	int		tepend;		/* 'te' is scheduled		*/
+#endif
+};
+
+static struct fwat *fwats = 0;		/* all watches			*/
+
+
+#ifdef FWAT_INOTIFY
+/* inotify watch, shared by all fwats for the same dir/file */
+struct iwd {
+	struct iwd	*next;
+	int		wd;
+	int		refs;
+};
+
+static struct iwd *iwds = 0;		/* inotify watches in use	*/
+static int ifd = -1;			/* inotify fd			*/
+static chn_t fwat_ch;			/* fake channel for 'ifd'	*/
+
+
+/*
+ *	wd_get()		[private]
+ *
+ *	add (or share) an inotify watch for 'path'
+ *
+ *	returns the watch descriptor, -1 on error
+ */
+static int wd_get (const char *path, unsigned int mask)
+{
+struct iwd *w;
+int wd;
+
+    if ((wd = inotify_add_watch (ifd, path, mask | IN_MASK_ADD)) == -1)
+	return -1;
+
+    for (w = iwds; w; w = w->next)
+	if (w->wd == wd) {
+	    ++w->refs;
+	    return wd;
+	}
+
+    w = sec_malloc (sizeof(struct iwd));		/* may exit */
+    w->wd = wd;
+    w->refs = 1;
+    w->next = iwds;
+    iwds = w;
+
+    return wd;
+}
+
+
+/*
+ *	wd_rel()		[private]
+ *
+ *	release watch 'wd' ('rm' == 0: the kernel removed it)
+ */
+static void wd_rel (int wd, int rm)
+{
+struct iwd *w, **wp;
+
+    for (wp = &iwds; (w = *wp); wp = &w->next)
+	if (w->wd == wd)
+	    break;
+    if (! w)
+	return;
+
+    if (rm && --w->refs > 0)
+	return;
+
+    *wp = w->next;
+    free (w);
+    if (rm)
+	(void) inotify_rm_watch (ifd, wd);
+
+    return;
+}
+
+
+/*
+ *	fwat_input()		[private]
+ *
+ *	input function for the inotify fd: find the watches
+ *	affected by the events, call their functions
+ */
+static int fwat_input (int fd, buf_t *b, chn_t *ch)
+{
+union {
+	struct inotify_event	ev;
+	char			buf[4096];
+} u;
+const struct inotify_event *ev;
+struct fwat *f;
+ssize_t n, off;
+
+    (void) b;
+    (void) ch;
+
+    if ((n = read (fd, u.buf, sizeof u.buf)) == -1) {
+	if (errno != EAGAIN && errno != EINTR)
+	    mlpx_printf (CHN_MSG, MF_ERR, "fwat_input(): read(): %s\n",
+							strerror(errno));
+	return 0;
+    }
+
+    for (off = 0; off < n; off += sizeof(struct inotify_event) + ev->len) {
+	ev = (const struct inotify_event *) (u.buf + off);
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+	    /* events lost, check everything */
+	    for (f = fwats; f; f = f->next)
+		f->fired = 1;
+	    continue;
+	}
+
+	if (ev->mask & IN_IGNORED) {
+	    /* watch is gone (file deleted, ...) */
+	    wd_rel (ev->wd, 0);
+	    for (f = fwats; f; f = f->next) {
+		if (f->dwd == ev->wd)
+		    f->dwd = -1;
+		if (f->fwd == ev->wd)
+		    f->fwd = -1;
+	    }
+	    continue;
+	}
+
+	for (f = fwats; f; f = f->next) {
+	    if (ev->wd == f->fwd) {
+		f->fired = 1;
+		continue;
+	    }
+	    if (ev->wd != f->dwd || ! ev->len || strcmp (ev->name, f->base))
+		continue;
+
+	    f->fired = 1;
+	    if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+		/* a new file under the name, watch that one */
+		if (f->fwd != -1)
+		    wd_rel (f->fwd, 1);
+		f->fwd = wd_get (f->path, FWAT_FMASK);
+	    }
+	}
+    }
+
+    /* a function may add / remove watches: start over after it */
+    for (f = fwats; f; /**/)
+	if (f->fired) {
+	    f->fired = 0;
+	    f->fun (f->data);
+	    f = fwats;
+	} else
+	    f = f->next;
+
+    return 0;
+}
+
+
+/*
+ *	fwat_start()		[private]
+ *
+ *	setup inotify
+ *
+ *	returns 0 on success, -1 on error
+ */
+static int fwat_start (void)
+{
+    if ((ifd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+	mlpx_printf (CHN_MSG, MF_ERR, "inotify_init1(): %s\n",
+							strerror(errno));
+	return -1;
+    }
+
+    /* fake channel for the scheduler */
+    mlpx_init_chn (&fwat_ch, CHN_INT, 0);
+    fwat_ch.flags = CHN_F_RD;
+    fwat_ch.fd = ifd;
+    tesc_add_reader (&fwat_ch, fwat_input, 0);
+
+    return 0;
+}
+
+
+#else
+/*
+ *	fwat_timed()		[private]
+ *
+ *	poll timer: assume the file has changed
+ */
+static void fwat_timed (timedev_t *te)
+{
+struct fwat *f = te->data;
+
+    f->tepend = 0;
+    te->inms = FWAT_POLL;
+    if (! tesc_timedev (te))
+	f->tepend = 1;
+
+    f->fun (f->data);
+
+    return;
+}
+#endif
+
+
+/*
+ *	fwat_add()
+ *
+ *	watch the file 'path', call 'fun' with 'data' when it
+ *	(or its directory entry) changes. the file need not
+ *	exist, but its directory must.
+ *
+ *	returns the watch, 0 on failure (outputs error msg)
+ */
+struct fwat *fwat_add (const char *path, fwatfun_t fun, void *data)
+{
+struct fwat *f;
+char *cp;
+#ifdef FWAT_INOTIFY
+char *dbuf = 0;
+const char *dir;
+#endif
+
+    f = sec_malloc (sizeof(struct fwat));		/* may exit */
+    f->path = sec_malloc (strlen (path) + 1);		/* may exit */
+    strcpy (f->path, path);
+    f->base = (cp = strrchr (f->path, '/')) ? cp + 1 : f->path;
+    f->fun = fun;
+    f->data = data;
+
+#ifdef FWAT_INOTIFY
+    if (ifd == -1 && fwat_start () == -1) {
+	free (f->path);
+	free (f);
+	return 0;
+    }
+
+    /* the directory */
+    if (f->base == f->path)
+	dir = ".";
+    else if (f->base == f->path + 1)
+	dir = "/";
+    else {
+	dbuf = sec_malloc (f->base - f->path);		/* may exit */
+	memcpy (dbuf, f->path, f->base - f->path - 1);
+	dbuf[f->base - f->path - 1] = 0;
+	dir = dbuf;
+    }
+    f->dwd = wd_get (dir, FWAT_DMASK);
+    if (f->dwd == -1)
+	mlpx_printf (CHN_MSG, MF_ERR, "inotify_add_watch(): %s: %s\n",
+						dir, strerror(errno));
+    free (dbuf);
+
+    if (f->dwd == -1) {
+	free (f->path);
+	free (f);
+	return 0;
+    }
+
+    f->fwd = wd_get (f->path, FWAT_FMASK);	/* -1 if not (yet) there */
+    f->fired = 0;
+#else
+    f->te.inms = FWAT_POLL;
+    f->te.func = fwat_timed;
+    f->te.data = f;
+    f->tepend = ! tesc_timedev (&f->te);
+#endif
+
+    f->next = fwats;
+    fwats = f;
+
+    return f;
+}
+
+
+/*
+ *	fwat_del()
+ *
+ *	remove the watch 'f'
+ */
+void fwat_del (struct fwat *f)
+{
+struct fwat **fp;
+
+    for (fp = &fwats; *fp; fp = &(*fp)->next)
+	if (*fp == f) {
+	    *fp = f->next;
+	    break;
+	}
+
+#ifdef FWAT_INOTIFY
+    if (f->dwd != -1)
+	wd_rel (f->dwd, 1);
+    if (f->fwd != -1)
+	wd_rel (f->fwd, 1);
+#else
+    if (f->tepend)
+	(void) tesc_untimedev (&f->te);
+#endif
+
+    free (f->path);
+    free (f);
+
+    return;
+}
+
+
+/*
+ *	follow_event()		[private]
+ *
+ *	the followed file may have changed, read again
+ */
+static void follow_event (void *data)
+{
+chn_t *ch = data;
+
+    ch->hold &= ~CHN_H_EOF;
+
+    return;
+}
+
+
+/*
+ *	fwat_follow()
+ *
+ *	open a follow channel: open the file, start at its end
+ *
+ *	return value like cmdi_open()
+ */
+int fwat_follow (chn_t *ch)
+{
+const char *path = ch->cf->method.str;
+
+    if ((ch->fd = open (path, O_RDONLY | O_NONBLOCK | O_NOCTTY)) == -1) {
+	mlpx_printf (CHN_CMD, MF_ERR, "open %0*X: %s: %s\n",
+			mlpx_idlen(), ch->id, path, strerror(errno));
+	return -1;
+    }
+    (void) fcntl (ch->fd, F_SETFD, FD_CLOEXEC);
+
+    if (! (ch->fw = fwat_add (path, follow_event, ch))) {
+	(void) close (ch->fd);
+	ch->fd = -1;
+	return -1;
+    }
+
+    /* only new data */
+    (void) lseek (ch->fd, 0, SEEK_END);
+
+    ch->flags = CHN_F_RD;
+
+    /* buffers, logfile, motd */
+    mlpx_setup_ch (ch);
+
+    ch->hold |= CHN_H_EOF;	/* until the file changes */
+
+    return 0;
+}
+
+
+/*
+ *	fwat_eof()
+ *
+ *	end of the followed file reached: start over if it was
+ *	truncated, switch to the new file if it was replaced,
+ *	else wait for changes (input on hold)
+ */
+void fwat_eof (chn_t *ch)
+{
+const char *path = ch->cf->method.str;
+struct stat st, nst;
+off_t pos;
+int fd;
+
+    if (fstat (ch->fd, &st) == -1 ||
+		(pos = lseek (ch->fd, 0, SEEK_CUR)) == (off_t) -1) {
+	ch->hold |= CHN_H_EOF;
+	return;
+    }
+
+    if (S_ISREG(st.st_mode) && st.st_size < pos) {
+	mlpx_printf (CHN_MSG, 0, "channel %0*X: %s: file truncated\n",
+						mlpx_idlen(), ch->id, path);
+	(void) lseek (ch->fd, 0, SEEK_SET);
+	return;		/* read again */
+    }
+
+    if (stat (path, &nst) == 0 &&
+		(nst.st_ino != st.st_ino || nst.st_dev != st.st_dev) &&
+		(fd = open (path, O_RDONLY | O_NONBLOCK | O_NOCTTY)) != -1) {
+	/* replace the file behind the channel's fd (fdio stays) */
+	mlpx_printf (CHN_MSG, 0, "channel %0*X: %s: file replaced, "
+					"following new file\n",
+						mlpx_idlen(), ch->id, path);
+	if (dup2 (fd, ch->fd) == -1)
+	    mlpx_printf (CHN_MSG, MF_ERR, "dup2(): %s\n", strerror(errno));
+	else
+	    (void) fcntl (ch->fd, F_SETFD, FD_CLOEXEC);
+	(void) close (fd);
+	return;		/* read the new one */
+    }
+
+    ch->hold |= CHN_H_EOF;
+
+    return;
+}
+
+
+/*
+ *	fwat_unfollow()
+ *
+ *	stop watching the file of a follow channel (if any)
+ */
+void fwat_unfollow (chn_t *ch)
+{
+    if (ch->fw) {
+	fwat_del (ch->fw);
+	ch->fw = 0;
+    }
+
+    return;
+}
+
+
+/*** end ***/
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2026 bytemine GmbH <info@bytemine.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef FWAT_H
+#define FWAT_H
+/*
+ *	ut: fwat.h
+ *
+ *	file watching, follow method
+ */
+
+/* needs "mlpx.h" */
+
+
+/* change callback: client data */
+typedef void (*fwatfun_t) (void *);
+
+struct fwat;
+
+extern struct fwat *fwat_add (const char *, fwatfun_t, void *);
+extern void fwat_del (struct fwat *);
+extern int fwat_follow (chn_t *);
+extern void fwat_eof (chn_t *);
+extern void fwat_unfollow (chn_t *);
+
+
+#endif /* ! FWAT_H */
@@ -0,0 +1,423 @@
+/*
+ * Copyright (c) 2026 bytemine GmbH <info@bytemine.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ *	ut: logw.c
+ *
+ *	log files, written by a separate thread
+ *
+ *	the scheduler only copies log data to a ring buffer per
+ *	log fd, a writer thread (started on first use) writes
+ *	out whatever has accumulated with one writev(). so a
+ *	slow disk no longer stalls the scheduler.
+ *
+ *	if a ring is full, the data is dropped (whole messages)
+ *	and counted. a line "!N bytes dropped" is put into the
+ *	log as soon as there is room again. the rings are
+ *	flushed by the main thread at exit().
+ *
+ *	fds not registered with logw_add() (or if the thread
+ *	cannot be started) are written synchronously.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "conf.h"
+#include "mlpx.h"
+#include "data.h"
+#include "tesc.h"
+#include "logw.h"
+
+
+#define LOGW_RING	0x10000		/* ring size per log fd		*/
+#define LOGW_MAPSIZ	64		/* initial size of the fd map	*/
+
+
+/* ring buffer for one log fd */
+struct logr {
+	int		fd;
+	unsigned long	rd;		/* total # of bytes written	*/
+	unsigned long	wr;		/* total # of bytes put in	*/
+	unsigned long	ndrop;		/* # of bytes dropped (total)	*/
+	unsigned long	udrop;		/*   -- " -- (not yet noted)	*/
+	int		err;		/* errno of failed write (or 0)	*/
+	int		closing;	/* close fd when empty		*/
+	char		buf[LOGW_RING];
+};
+
+
+static int started = 0;			/* thread is running		*/
+static int failed = 0;			/* thread could not be started	*/
+
+/* shared with the writer thread */
+static pthread_mutex_t lw_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lw_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t lw_idle = PTHREAD_COND_INITIALIZER;
+static struct logr **rings = 0;		/* fd -> ring			*/
+static int nrings = 0;			/* size of 'rings'		*/
+static int lw_pend = 0;			/* data / close pending		*/
+static int lw_busy = 0;			/* writer is writing		*/
+static int lw_stop = 0;			/* exit() in progress		*/
+
+static void ring_note (struct logr *);
+
+
+/*
+ *	ring_flush()	[private]
+ *
+ *	write out everything in 'r', 'lw_lock' is held on entry
+ *	and exit, but not while writing (if 'unlock' is set)
+ */
+static void ring_flush (struct logr *r, int unlock)
+{
+struct iovec iov[2];
+unsigned long n, off;
+ssize_t l;
+int cnt;
+
+    while ((n = r->wr - r->rd)) {
+	off = r->rd % LOGW_RING;
+	iov[0].iov_base = r->buf + off;
+	iov[0].iov_len = n < LOGW_RING - off ? n : LOGW_RING - off;
+	iov[1].iov_base = r->buf;
+	iov[1].iov_len = n - iov[0].iov_len;
+	cnt = iov[1].iov_len ? 2 : 1;
+
+	/* the main thread only appends, this part stays as is */
+	if (unlock)
+	    pthread_mutex_unlock (&lw_lock);
+	l = writev (r->fd, iov, cnt);
+	if (unlock)
+	    pthread_mutex_lock (&lw_lock);
+
+	if (l == -1) {
+	    if (errno == EINTR)
+		continue;
+	    /* record error (reported by logw_write()), discard data */
+	    r->err = errno;
+	    r->ndrop += n;
+	    r->rd = r->wr;
+	    break;
+	}
+	r->rd += l;
+    }
+
+    return;
+}
+
+
+/*
+ *	logw_worker()	[private]
+ *
+ *	writer thread: flush rings with data, close the
+ *	fds of rings removed with logw_close()
+ */
+static void *logw_worker (void *arg)
+{
+struct logr *r;
+int i;
+
+    (void) arg;
+
+    pthread_mutex_lock (&lw_lock);
+    for (;;) {
+	while (! lw_pend && ! lw_stop)
+	    pthread_cond_wait (&lw_cond, &lw_lock);
+	if (lw_stop)
+	    break;
+	lw_pend = 0;
+	lw_busy = 1;
+
+	for (i = 0; i < nrings && ! lw_stop; ++i) {
+	    if (! (r = rings[i]))
+		continue;
+
+	    ring_flush (r, 1);
+
+	    if (r->closing && r->rd == r->wr) {
+		/* slot is free before the fd can be reused */
+		rings[i] = 0;
+		pthread_mutex_unlock (&lw_lock);
+		(void) close (r->fd);
+		free (r);
+		pthread_mutex_lock (&lw_lock);
+	    }
+	}
+
+	lw_busy = 0;
+	pthread_cond_broadcast (&lw_idle);
+    }
+    pthread_mutex_unlock (&lw_lock);
+
+    return 0;
+}
+
+
+/*
+ *	logw_exit()	[private, atexit()]
+ *
+ *	stop the writer thread, write out what is left
+ */
+static void logw_exit (void)
+{
+int i;
+
+    pthread_mutex_lock (&lw_lock);
+    lw_stop = 1;
+    pthread_cond_signal (&lw_cond);
+    while (lw_busy)
+	pthread_cond_wait (&lw_idle, &lw_lock);
+
+    for (i = 0; i < nrings; ++i)
+	if (rings[i]) {
+	    ring_flush (rings[i], 0);
+	    ring_note (rings[i]);
+	    ring_flush (rings[i], 0);
+	}
+    pthread_mutex_unlock (&lw_lock);
+
+    return;
+}
+
+
+/*
+ *	logw_start()	[private]
+ *
+ *	start the writer thread
+ *
+ *	returns 0 on success, -1 on error
+ */
+static int logw_start (void)
+{
+pthread_t t;
+sigset_t all, old;
+int r;
+
+    /* the thread must not get any signals */
+    sigfillset (&all);
+    pthread_sigmask (SIG_BLOCK, &all, &old);
+    r = pthread_create (&t, 0, logw_worker, 0);
+    pthread_sigmask (SIG_SETMASK, &old, 0);
+
+    if (r) {
+	mlpx_printf (CHN_MSG, MF_ERR, "log writer: cannot start thread, "
+					"writing logs synchronously\n");
+	failed = 1;
+	return -1;
+    }
+    pthread_detach (t);
+    (void) atexit (logw_exit);
+
+    started = 1;
+
+    return 0;
+}
+
+
+/*
+ *	logw_add()
+ *
+ *	setup a ring buffer for the log file 'fd'
+ *	(already registered: nothing happens)
+ */
+void logw_add (int fd)
+{
+struct logr *r, **tmp = 0;
+int i, n = 0;
+
+    if (fd < 0 || failed || (! started && logw_start () == -1))
+	return;
+
+    r = sec_malloc (sizeof(struct logr));		/* may exit */
+    r->fd = fd;
+    r->rd = r->wr = 0;
+    r->ndrop = r->udrop = 0;
+    r->err = 0;
+    r->closing = 0;
+
+    if (fd >= nrings) {
+	/* (nrings only changes here) */
+	for (n = nrings ? nrings : LOGW_MAPSIZ; n <= fd; n *= 2)
+	    ;
+	tmp = sec_malloc (n * sizeof(*tmp));		/* may exit */
+    }
+
+    pthread_mutex_lock (&lw_lock);
+    if (tmp) {
+	for (i = 0; i < n; ++i)
+	    tmp[i] = i < nrings ? rings[i] : 0;
+	free (rings);
+	rings = tmp;
+	nrings = n;
+    }
+    if (rings[fd])
+	free (r);	/* shared, e.g. the global log */
+    else
+	rings[fd] = r;
+    pthread_mutex_unlock (&lw_lock);
+
+    return;
+}
+
+
+/*
+ *	ring_put()	[private]
+ *
+ *	append 'len' bytes from 'p' to 'r' (which has room)
+ */
+static void ring_put (struct logr *r, const char *p, size_t len)
+{
+size_t off, l;
+
+    off = r->wr % LOGW_RING;
+    l = len < LOGW_RING - off ? len : LOGW_RING - off;
+    memcpy (r->buf + off, p, l);
+    memcpy (r->buf, p + l, len - l);
+    r->wr += len;
+
+    return;
+}
+
+
+/*
+ *	ring_note()	[private]
+ *
+ *	note the # of bytes dropped in the log (if there is room)
+ */
+static void ring_note (struct logr *r)
+{
+char note[48];
+size_t l;
+
+    if (! r->udrop)
+	return;
+
+    l = snprintf (note, sizeof note, "!%lu bytes dropped\n", r->udrop);
+    if (l <= LOGW_RING - (r->wr - r->rd)) {
+	ring_put (r, note, l);
+	r->udrop = 0;
+    }
+
+    return;
+}
+
+
+/*
+ *	logw_write()
+ *
+ *	append the data in 'iov' to the log file 'fd'
+ *
+ *	returns 0 on success (or if the data was dropped), -1
+ *	(errno set) if an earlier write to 'fd' failed
+ */
+int logw_write (int fd, const struct iovec *iov, int n)
+{
+struct logr *r = 0;
+size_t len;
+int i;
+
+    pthread_mutex_lock (&lw_lock);
+    if (fd >= 0 && fd < nrings)
+	r = rings[fd];
+
+    if (! r) {
+	pthread_mutex_unlock (&lw_lock);
+	return writev (fd, iov, n) == -1 ? -1 : 0;
+    }
+
+    if (r->err) {
+	errno = r->err;
+	r->err = 0;
+	pthread_mutex_unlock (&lw_lock);
+	return -1;
+    }
+
+    for (i = 0, len = 0; i < n; ++i)
+	len += iov[i].iov_len;
+
+    ring_note (r);
+
+    if (r->udrop || len > LOGW_RING - (r->wr - r->rd)) {
+	/* ring is full (or still behind a gap) */
+	r->ndrop += len;
+	r->udrop += len;
+    } else
+	for (i = 0; i < n; ++i)
+	    ring_put (r, iov[i].iov_base, iov[i].iov_len);
+
+    if (! lw_pend && r->wr != r->rd) {
+	lw_pend = 1;
+	pthread_cond_signal (&lw_cond);
+    }
+    pthread_mutex_unlock (&lw_lock);
+
+    return 0;
+}
+
+
+/*
+ *	logw_close()
+ *
+ *	close the log file 'fd' (after its data is written)
+ */
+void logw_close (int fd)
+{
+struct logr *r = 0;
+
+    pthread_mutex_lock (&lw_lock);
+    if (fd >= 0 && fd < nrings)
+	r = rings[fd];
+    if (r) {
+	r->closing = 1;
+	lw_pend = 1;
+	pthread_cond_signal (&lw_cond);
+    }
+    pthread_mutex_unlock (&lw_lock);
+
+    if (! r)
+	(void) close (fd);
+
+    return;
+}
+
+
+/*
+ *	logw_dropped()
+ *
+ *	returns the # of bytes dropped for the log file 'fd'
+ */
+unsigned long logw_dropped (int fd)
+{
+unsigned long n = 0;
+
+    pthread_mutex_lock (&lw_lock);
+    if (fd >= 0 && fd < nrings && rings[fd])
+	n = rings[fd]->ndrop;
+    pthread_mutex_unlock (&lw_lock);
+
+    return n;
+}
+
+
+/*** end ***/
@@ -25,13 +25,14 @@
  *	[ channel based service multiplexer ]
  *
  *	usage:
- *	ut [ -c configfile ]
+ *	ut [ -x ] [ -c configfile ]
  *
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <signal.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -48,6 +49,7 @@
 #include "mlpx.h"
 #include "data.h"
 #include "tesc.h"
+#include "proc.h"
 
 
 #ifndef UT_KASTRING
@@ -122,6 +124,7 @@ const char *cfpath;
 const struct config *cf;
 timedev_t ka;
 int cffd;	/* must stay open until ut exits */
+struct rlimit rl;
 
 
     /*
@@ -131,11 +134,14 @@ int cffd;	/* must stay open until ut exits */
     cfpath = UT_CONFIG_PATH;		/* conf.h or Makefile override */
 
     opterr = 0;		/* no extra error msgs from getopt() */
-    while ((i = getopt (ac, av, "c:")) != -1) {
+    while ((i = getopt (ac, av, "c:x")) != -1) {
 	switch (i) {
 	    case 'c' :			/* -c configfile */
 		cfpath = optarg;
 		break;
+	    case 'x' :			/* -x extended channel ids */
+		mlpx_set_xid (1);
+		break;
 	    case '?' :
 		/* optopt contains opt */
 		tesc_emerg (CHN_MSG, MF_ERR, "unknown option '%c'\n", optopt);
@@ -169,12 +175,23 @@ int cffd;	/* must stay open until ut exits */
     /* read config file */
     cf = conf_init (cffd);
 
+    /* with extended channel ids we may need lots of fds */
+    if (mlpx_maxid() > CHN_MAX && getrlimit (RLIMIT_NOFILE, &rl) == 0 &&
+						rl.rlim_cur < rl.rlim_max) {
+	rl.rlim_cur = rl.rlim_max;
+	if (setrlimit (RLIMIT_NOFILE, &rl) == -1)
+	    tesc_emerg (CHN_MSG, MF_ERR, "setrlimit(): %s\n", strerror(errno));
+    }
+
     /* setup scheduler */
     tesc_init (cf);
 
     /* initialize mux/demux */
     mlpx_init (cf);
 
+    /* reap child processes on SIGCHLD */
+    proc_init ();
+
     /* activate keepalive */
     ka.inms = cf->keepalive * 1000;
     ka.func = keepalive;
@@ -25,13 +25,19 @@
  *	channels, mux/demux
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE		/* splice() */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <netdb.h>
 #include <signal.h>
 #include <unistd.h>
 #include <string.h>
@@ -42,17 +48,332 @@
 #include "data.h"
 #include "tesc.h"
 #include "cmdi.h"
+#include "filt.h"
+#include "proc.h"
+#include "fwat.h"
+#include "resv.h"
+#include "logw.h"
 #include "util.h"
 
 
 static chn_t ch_main_in;		/* 'fake' channels for the	*/
 static chn_t ch_main_out;		/*   main input/output fds	*/
 
+#define LINK_CHUNK	0x10000		/* max splice() size for links	*/
+
+/*
+ *	token bucket for rate limited channels. tokens are kept in
+ *	1/1000 units, so each ms of elapsed time adds exactly 'rate'
+ *	(per second) of them. the bucket holds at most one second
+ *	worth of tokens. if a limit is configured and its tokens
+ *	are used up, the channel is put on hold (no POLLIN) and a
+ *	timed event is scheduled for the refill.
+ */
+struct tbucket {
+	long long	bytes;		/* byte tokens (1/1000)		*/
+	long long	lines;		/* line tokens (1/1000)		*/
+	struct timeval	last;		/* time of last refill		*/
+	timedev_t	te;		/* refill event			*/
+	int		pend;		/* 'te' is scheduled		*/
+};
+
+/*
+ *	priority lanes for the main output. mux() appends to the
+ *	pending queue of the channel, and the channel to the
+ *	lane (if not already there). the main output queue is
+ *	fed one message at a time (from the highest non-empty
+ *	lane) whenever it becomes empty. so a message in a higher
+ *	lane has to wait for at most one message from a lower one.
+ *
+ *	the channels in a lane are served by deficit round robin
+ *	(see mainout_feed()).
+ */
+static struct {
+	chn_t		*head;
+	chn_t		*tail;
+} lanes[CHN_NPRIO];
+
 static const struct config *cf = 0;	/* config data			*/
-static chn_t *chmap[CHN_MAX + 1];	/* channel id -> chn_t		*/
+static chn_t **chmap = 0;		/* channel id -> chn_t		*/
+static int chmapsiz = 0;		/* # of entries in chmap	*/
+static int idlen = CHN_IDLEN;		/* # of hex digits for id	*/
 
 
 void mux (msg_t *, const chn_t *);
+static void tb_take (chn_t *, unsigned long, int);
+static void mainout_feed (chn_t *);
+static void chn_out (msg_t *, const chn_t *);
+
+
+/*
+ *	mlpx_set_xid()
+ *
+ *	select extended (4 digit) channel ids, must be
+ *	called before any output is done
+ */
+void mlpx_set_xid (int on)
+{
+    idlen = on ? CHN_XIDLEN : CHN_IDLEN;
+
+    return;
+}
+
+
+/*
+ *	mlpx_idlen()
+ *
+ *	return # of hex digits used for channel ids in prefixes
+ */
+int mlpx_idlen ()
+{
+    return idlen;
+}
+
+
+/*
+ *	mlpx_maxid()
+ *
+ *	return the highest usable channel id
+ */
+int mlpx_maxid ()
+{
+    return idlen == CHN_XIDLEN ? CHN_XMAX : CHN_MAX;
+}
+
+
+/*
+ *	mlpx_topid()
+ *
+ *	return an upper bound for the ids of the channels
+ *	currently defined (the end of the channel map)
+ */
+int mlpx_topid ()
+{
+    return chmapsiz - 1;
+}
+
+
+/*
+ *	chmap_grow()	[private]
+ *
+ *	make sure 'id' fits into chmap, new entries are cleared
+ */
+static void chmap_grow (int id)
+{
+int i, n;
+chn_t **tmp;
+
+    if (id < chmapsiz)
+	return;
+
+    for (n = chmapsiz ? chmapsiz : CHN_MAX + 1; n <= id; n *= 2)
+	;
+
+    tmp = sec_malloc (n * sizeof(*tmp));		/* may exit */
+    for (i = 0; i < n; ++i)
+	tmp[i] = i < chmapsiz ? chmap[i] : 0;
+
+    if (chmap)
+	free (chmap);
+    chmap = tmp;
+    chmapsiz = n;
+
+    return;
+}
+
+
+/*
+ *	mlpx_init_chn()
+ *
+ *	initialize a chn_t (inactive)
+ */
+void mlpx_init_chn (chn_t *ch, int id, struct channel *chcf)
+{
+    ch->flags = 0;		/* not active */
+    ch->id = id;
+    ch->fd = -1;		/* closed */
+    ch->log = -1;		/* closed */
+    ch->pid = 0;
+    ch->pxfl = 0;
+    ch->cf = chcf;
+    ch->timeout = 0;		/* disable */
+    ch->stalled = 0;
+    ch->fst = 0;		/* no filter */
+    if (chcf && chcf->prio)
+	ch->prio = chcf->prio - 1;
+    else if (id == CHN_CMD || id == CHN_MSG)
+	ch->prio = CHN_PRIO_TOP;
+    else
+	ch->prio = CHN_PRIO_DEF;
+    ch->drained = 0;
+    ch->weight = (chcf && chcf->weight) ? chcf->weight : 1;
+    ch->deficit = 0;
+    ch->pq = ch->pt = 0;	/* nothing pending */
+    ch->pnext = 0;
+    ch->hold = 0;
+    ch->nrd = 0;
+    ch->nwr = 0;
+    ch->link = 0;		/* not linked */
+    ch->lsrc = 0;
+    ch->lp[0] = ch->lp[1] = -1;
+    ch->lpend = 0;
+    ch->lmark = 0;
+    ch->tb = 0;			/* no rate limit */
+    ch->iop = 0;
+    ch->rc = 0;
+    ch->oto = 0;
+    ch->blk = 0;
+    ch->tag = 0;
+    ch->pp = 0;
+    ch->fw = 0;
+    ch->ao = 0;
+    ch->lsn = 0;
+    ch->nacc = 0;
+    ch->roff = 0;
+
+    return;
+}
+
+
+/*
+ *	new_chn()	[private]
+ *
+ *	allocate an (inactive) chn_t for 'id' and insert it in chmap
+ */
+static chn_t *new_chn (int id, struct channel *chcf)
+{
+chn_t *ch;
+
+    chmap_grow (id);					/* may exit */
+
+    ch = sec_malloc (sizeof(chn_t));			/* may exit */
+    mlpx_init_chn (ch, id, chcf);
+
+    chmap[id] = ch;
+
+    cmdi_pool_fill (ch);		/* start idle processes */
+
+    return ch;
+}
+
+
+/*
+ *	mlpx_new_chn()
+ *
+ *	create a channel (at runtime) for config 'chcf', using
+ *	the lowest free channel id. announce it on CHN_CMD.
+ *
+ *	returns 0 if no free channel id is left
+ */
+chn_t *mlpx_new_chn (struct channel *chcf)
+{
+int id;
+chn_t *ch;
+
+    for (id = CHN_CMD + 1; id <= mlpx_maxid(); ++id)
+	if (id != CHN_MSG && ! mlpx_id2chn (id))
+	    break;
+
+    if (id > mlpx_maxid()) {
+	mlpx_printf (CHN_MSG, MF_ERR, "no free channel id left\n");
+	return 0;
+    }
+
+    ch = new_chn (id, chcf);				/* may exit */
+
+    mlpx_printf (CHN_CMD, 0, "DEFINE %0*X %s \"%s\"\n", idlen, id,
+						chcf->type, chcf->name);
+
+    return ch;
+}
+
+
+/*
+ *	mlpx_del_chn()
+ *
+ *	remove an inactive channel, announce it on CHN_CMD.
+ *	the config is freed if it was defined at runtime.
+ *
+ *	returns 0 on success, -1 on error
+ */
+int mlpx_del_chn (chn_t *ch)
+{
+    if (ch->id == CHN_CMD || ch->id == CHN_MSG || (ch->flags & ~CHN_ERROR))
+	return -1;	/* cannot remove active or fake channels */
+
+    if (ch->pq)
+	return -1;	/* output for main out still pending */
+
+    if (ch->nacc)
+	return -1;	/* accepted connections use the config */
+
+    chmap[ch->id] = 0;
+
+    cmdi_pool_free (ch);
+    resv_cancel (ch);		/* no late resolver callback */
+
+    mlpx_printf (CHN_CMD, 0, "UNDEFINE %0*X\n", idlen, ch->id);
+
+    if (ch->lsn)
+	--ch->lsn->nacc;	/* config belongs to the listener */
+    else if (ch->cf && ch->cf->rtdef)
+	/* get the enclosing struct chnlist */
+	conf_free_channel ((struct chnlist *) ((char *) ch->cf -
+					offsetof (struct chnlist, channel)));
+    free (ch->fst);
+    free (ch->tb);
+    free (ch->rc);
+    free (ch->ao);
+    free (ch->oto);
+    free (ch->tag);
+    free (ch);
+
+    return 0;
+}
+
+
+/*
+ *	mlpx_drop_chn()
+ *
+ *	remove an accepted connection after it was closed. output
+ *	still pending for the main out is queued there right away
+ *	(out of turn), so the channel can go at once.
+ */
+void mlpx_drop_chn (chn_t *ch)
+{
+chn_t **pp, *prev;
+msg_t *m;
+
+    if (! ch->lsn)
+	return;		/* configured channels stay */
+
+    if (ch->pq) {
+	/* remove from its lane */
+	for (prev = 0, pp = &lanes[ch->prio].head; *pp != ch;
+						prev = *pp, pp = &(*pp)->pnext)
+	    ;
+	*pp = ch->pnext;
+	if (lanes[ch->prio].tail == ch)
+	    lanes[ch->prio].tail = prev;
+	ch->pnext = 0;
+
+	while ((m = ch->pq)) {
+	    ch->pq = m->next;
+	    m->next = 0;
+	    if (tesc_enq_wq (&ch_main_out, m)) {
+		tesc_emerg (CHN_MSG, MF_ERR,
+				"mlpx_drop_chn(): tesc_enq_wq() failed\n");
+		tesc_emerg (CHN_MSG, MF_EOF, "\n");
+		exit (1);
+	    }
+	}
+	ch->pt = 0;
+    }
+
+    (void) mlpx_del_chn (ch);
+
+    return;
+}
 
 
 /*
@@ -64,13 +385,316 @@ void mux (msg_t *, const chn_t *);
  */
 chn_t *mlpx_id2chn (int id)
 {
-    if (id < 0 || id > CHN_MAX)
+    if (id < 0 || id >= chmapsiz)
 	return 0;	/* invalid id */
 
     return chmap[id];
 }
 
 
+/*
+ *	tb_refill()	[private]
+ *
+ *	add the tokens for the time elapsed since the last refill
+ */
+static void tb_refill (chn_t *ch)
+{
+struct tbucket *tb = ch->tb;
+struct timeval now;
+long long ms;
+
+    if (gettimeofday (&now, 0) == -1)
+	return;		/* try again later */
+
+    ms = (long long) (now.tv_sec - tb->last.tv_sec) * 1000 +
+				(now.tv_usec - tb->last.tv_usec) / 1000;
+    if (ms <= 0)
+	return;
+
+    /* advance by whole ms only, the rest is kept for the next refill */
+    tb->last.tv_sec += ms / 1000;
+    tb->last.tv_usec += (ms % 1000) * 1000;
+    if (tb->last.tv_usec >= 1000000) {
+	++tb->last.tv_sec;
+	tb->last.tv_usec -= 1000000;
+    }
+
+    tb->bytes += ms * ch->cf->rlbytes;
+    if (tb->bytes > 1000LL * ch->cf->rlbytes)
+	tb->bytes = 1000LL * ch->cf->rlbytes;
+    tb->lines += ms * ch->cf->rllines;
+    if (tb->lines > 1000LL * ch->cf->rllines)
+	tb->lines = 1000LL * ch->cf->rllines;
+
+    return;
+}
+
+
+/*
+ *	tb_timed()	[private, used for tesc_timedev()]
+ *
+ *	refill event for rate limited channels
+ */
+static void tb_timed (timedev_t *te)
+{
+chn_t *ch = te->data;
+
+    ch->tb->pend = 0;
+    tb_take (ch, 0, 0);
+
+    return;
+}
+
+
+/*
+ *	tb_take()	[private]
+ *
+ *	take tokens for 'nb' bytes / 'nl' lines read from
+ *	the channel, hold (or resume) input as needed
+ */
+static void tb_take (chn_t *ch, unsigned long nb, int nl)
+{
+struct tbucket *tb = ch->tb;
+long long ms, t;
+
+    tb_refill (ch);
+
+    tb->bytes -= 1000LL * nb;
+    tb->lines -= 1000LL * nl;
+
+    /* time (ms) until tokens are available again */
+    ms = 0;
+    if (ch->cf->rlbytes && tb->bytes <= 0)
+	ms = -tb->bytes / ch->cf->rlbytes + 1;
+    if (ch->cf->rllines && tb->lines <= 0)
+	if ((t = -tb->lines / ch->cf->rllines + 1) > ms)
+	    ms = t;
+
+    if (!ms) {
+	ch->hold &= ~CHN_H_RATE;
+	return;
+    }
+
+    ch->hold |= CHN_H_RATE;
+    if (! tb->pend) {
+	tb->te.inms = ms;
+	tb->te.func = tb_timed;
+	tb->te.data = ch;
+	if (! tesc_timedev (&tb->te))
+	    tb->pend = 1;
+    }
+
+    return;
+}
+
+
+/*
+ *	link_splice()	[private]
+ *
+ *	input function for linked channels using splice():
+ *	move data from 'fd' to the link pipe and make sure
+ *	there is a splice marker in the write queue of the
+ *	linked channel (the data is moved to its fd from
+ *	the scheduler, in order with other queued msgs)
+ *
+ *	retval like data_buf_input()
+ */
+static int link_splice (int fd, chn_t *ch)
+{
+#ifdef __linux__
+ssize_t l;
+msg_t *m;
+
+    l = splice (fd, 0, ch->lp[1], 0, LINK_CHUNK,
+				SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+    if (l == -1) {
+	if (errno != EAGAIN) {
+	    mlpx_printf (ch->id, MF_ERR, "splice(): %s\n", strerror(errno));
+	    return -1;
+	}
+	/* pipe is full - wait until the linked channel drained it */
+	if (ch->lpend)
+	    ch->hold |= CHN_H_LINK;
+	return 0;
+    }
+
+    if (l == 0)
+	return -2;	/* EOF */
+
+    ch->nrd += l;
+    ch->lpend += l;
+
+    if (! ch->lmark) {
+	m = sec_malloc (sizeof(msg_t));			/* may exit */
+	m->next = 0;
+	m->flags = MF_SPLICE | MF_PLAIN;
+	m->len = 0;
+	m->refs = 0;
+	m->shr = 0;
+	ch->lmark = m;
+	tesc_enq_wq (ch->link, m);
+    }
+
+    return 0;
+#else
+    (void) fd;
+    (void) ch;
+    return -1;	/* not reached, lp[] is never set up */
+#endif
+}
+
+
+/*
+ *	chn_input()	[private]
+ *
+ *	input function for (sub) channels
+ */
+static int chn_input (int fd, buf_t *b, chn_t *ch)
+{
+unsigned long n = ch->nrd;
+int r;
+
+    if (ch->lp[1] != -1)
+	r = link_splice (fd, ch);
+    else if (ch->flags & CHN_F_DGRAM)
+	r = data_dgram_input (fd, b, ch);
+    else if (ch->cf->method.type == mtREAD)
+	r = data_file_input (fd, b, ch);
+    else
+	r = data_buf_input (fd, b, ch);
+
+    if (ch->tb && ch->nrd != n)
+	tb_take (ch, ch->nrd - n, 0);
+
+    /* files are read no faster than the main output takes them */
+    if ((ch->cf->method.type == mtREAD || ch->fw) && ch->pq)
+	ch->hold |= CHN_H_BP;
+
+    /* a line kept by the filter ends here */
+    if (r == -2 && ch->fst && ! ch->fw)
+	chn_out (0, ch);
+
+    /* followed files do not end */
+    if (r == -2 && ch->fw) {
+	fwat_eof (ch);
+	r = 0;
+    }
+
+    return r;
+}
+
+
+/*
+ *	chn_filter()	[private]
+ *
+ *	apply the filter of 'ch' to 'm', returns the msg to
+ *	forward (0 if it is dropped or kept for now)
+ *
+ *	incomplete lines (MF_NONL, not for datagrams) are kept
+ *	until the rest arrives, and forwarded as one line. 'm'
+ *	is 0 at EOF: what is kept is output as it is.
+ */
+static msg_t *chn_filter (msg_t *m, const chn_t *ch)
+{
+struct filtst *fs = ch->fst;
+msg_t *j;
+size_t dl = 0;
+int part = 0, pass;
+
+    if (m) {
+	part = (m->flags & MF_NONL) && ! (ch->flags & CHN_F_DGRAM);
+	dl = m->len - (part ? 1 : 0);	/* w/o added '\n' */
+    }
+
+    if (fs->cont && m) {
+	/* rest of a line which is decided already */
+	pass = fs->cont > 0;
+	if (! part)
+	    fs->cont = 0;	/* line is complete */
+	if (pass)
+	    return m;
+	free (m);
+	return 0;
+    }
+
+    if (part && fs->plen + dl <= FILT_PARTMAX) {
+	/* wait for the rest */
+	memcpy (fs->part + fs->plen, m->data, dl);
+	fs->plen += dl;
+	free (m);
+	return 0;
+    }
+
+    if (fs->plen) {
+	/* join with what is kept */
+	j = sec_malloc (sizeof(msg_t) + fs->plen +
+					(m ? m->len : 1));	/* may exit */
+	j->next = 0;
+	j->refs = 0;
+	j->shr = 0;
+	memcpy (j->data, fs->part, fs->plen);
+	if (m) {
+	    memcpy (j->data + fs->plen, m->data, m->len);
+	    j->len = fs->plen + m->len;
+	    j->flags = m->flags;
+	    free (m);
+	} else {
+	    j->data[fs->plen] = '\n';
+	    j->len = fs->plen + 1;
+	    j->flags = MF_PLAIN | MF_NONL;
+	}
+	fs->plen = 0;
+	m = j;
+    } else if (! m)
+	return 0;	/* nothing to flush */
+
+    if (! filt_line (ch->cf->filter, fs, m->data, m->len)) {
+	if (part)
+	    fs->cont = -1;	/* drop the rest, too */
+	free (m);	/* filtered */
+	return 0;
+    }
+    if (part)
+	fs->cont = 1;
+
+    return m;
+}
+
+
+/*
+ *	chn_out()	[private]
+ *
+ *	output function for (sub) channel input buffers,
+ *	forward to mux or to the linked channel
+ */
+static void chn_out (msg_t *m, const chn_t *ch)
+{
+    if (ch->fst)
+	m = chn_filter (m, ch);
+    if (! m)
+	return;		/* filtered (or nothing to flush) */
+
+    if (ch->tb && ch->cf->rllines)
+	tb_take (mlpx_id2chn (ch->id), 0, 1);
+
+    if (! ch->link) {
+	mux (m, ch);
+	return;
+    }
+
+    if (m->flags & MF_NONL) {
+	/* no '\n' to be added, no prefix to announce it */
+	m->flags &= ~MF_NONL;
+	--m->len;
+    }
+
+    if (tesc_enq_wq (ch->link, m))
+	data_free_msg (m);
+
+    return;
+}
+
+
 /*
  *	mlpx_add_reader()
  *
@@ -81,8 +705,115 @@ void mlpx_add_reader (chn_t *ch)
 {
 buf_t *b;
 
-    b = data_new_buf (mux, 0, 1);	/* !wait, plain */
-    tesc_add_reader (ch, data_buf_input, b);
+    if (ch->cf && ch->cf->filter) {
+	if (! ch->fst)
+	    ch->fst = sec_malloc (sizeof(struct filtst));	/* may exit */
+	filt_reset (ch->fst);
+    }
+
+    if (ch->cf && (ch->cf->rlbytes || ch->cf->rllines)) {
+	if (! ch->tb) {
+	    ch->tb = sec_malloc (sizeof(struct tbucket));	/* may exit */
+	    ch->tb->pend = 0;
+	}
+	/* start with a full bucket */
+	ch->tb->bytes = 1000LL * ch->cf->rlbytes;
+	ch->tb->lines = 1000LL * ch->cf->rllines;
+	if (gettimeofday (&ch->tb->last, 0) == -1)
+	    ch->tb->last.tv_sec = ch->tb->last.tv_usec = 0;
+    }
+
+    b = data_new_buf (chn_out, 0, 1);	/* !wait, plain */
+    tesc_add_reader (ch, chn_input, b);
+
+    return;
+}
+
+
+/*
+ *	mlpx_link()
+ *
+ *	relay input of 'src' to 'dst' (instead of the main out).
+ *	if possible (no logfiles or filter involved), splice() through
+ *	a pipe is used, so the data never gets to userspace.
+ */
+void mlpx_link (chn_t *src, chn_t *dst)
+{
+#ifdef __linux__
+int i, fdfl;
+#endif
+
+    src->link = dst;
+    dst->lsrc = src;
+
+#ifdef __linux__
+    if (src->log != -1 || dst->log != -1 || src->fst ||
+					(src->tb && src->cf->rllines))
+	return;		/* need the data to log / filter / count it */
+
+    if ((src->flags | dst->flags) & CHN_F_DGRAM)
+	return;		/* a pipe would lose the datagram boundaries */
+
+    if (pipe (src->lp) == -1) {
+	src->lp[0] = src->lp[1] = -1;
+	return;		/* ok, relay via buffers */
+    }
+
+    for (i = 0; i < 2; ++i)
+	if ((fdfl = fcntl (src->lp[i], F_GETFL)) == -1 ||
+			fcntl (src->lp[i], F_SETFL, fdfl | O_NONBLOCK) == -1) {
+	    (void) close (src->lp[0]);
+	    (void) close (src->lp[1]);
+	    src->lp[0] = src->lp[1] = -1;
+	    return;
+	}
+#endif
+
+    return;
+}
+
+
+/*
+ *	mlpx_unlink()
+ *
+ *	remove link from 'src' to its linked channel. data
+ *	still in the link pipe is turned into a regular msg.
+ */
+void mlpx_unlink (chn_t *src)
+{
+msg_t *m;
+int l;
+
+    if (! src->link)
+	return;
+
+    if (src->lmark) {
+	/* fetch pending data from the pipe, replace the marker */
+	m = sec_malloc (sizeof(msg_t) + src->lpend);	/* may exit */
+	if ((l = read (src->lp[0], m->data, src->lpend)) == -1)
+	    l = 0;
+	m->next = 0;
+	m->flags = MF_PLAIN;
+	m->len = l;
+	m->refs = 1;
+	m->shr = 0;
+
+	src->lmark->flags = MF_SHARED | MF_PLAIN;
+	src->lmark->len = l;
+	src->lmark->shr = m;
+	src->lmark = 0;
+    }
+
+    if (src->lp[0] != -1) {
+	(void) close (src->lp[0]);
+	(void) close (src->lp[1]);
+	src->lp[0] = src->lp[1] = -1;
+    }
+
+    src->hold &= ~CHN_H_LINK;
+    src->lpend = 0;
+    src->link->lsrc = 0;
+    src->link = 0;
 
     return;
 }
@@ -117,7 +848,8 @@ int tc;
  *	prefix according to 'ch' (id) and 'flags'
  *	(flag MF_PLAIN will be set here)
  *
- *	(size is limited to MLPX_PRINTF_MAX bytes)
+ *	(size is limited to MLPX_PRINTF_MAX bytes, a longer
+ *	line is cut, keeping its '\n')
  */
 #define MLPX_PRINTF_MAX		1024
 void mlpx_printf (int id, int flags, const char *fmt, ...)
@@ -126,13 +858,14 @@ va_list ap;
 msg_t *m;
 int l;
 
-    if (!chmap[id]) {
+    if (! mlpx_id2chn (id)) {
 	/* invalid channel */
 	if (id == CHN_MSG)		/* huh, must not happen */
 	    exit (EXIT_FAILURE);	/* avoid inf. recursion */
 
 	mlpx_printf (CHN_MSG, MF_ERR,
-			"internal error: channel %02X does not exist\n", id);
+			"internal error: channel %0*X does not exist\n",
+								idlen, id);
 	return;
     }
 
@@ -140,10 +873,20 @@ int l;
 
     m = sec_malloc (sizeof(msg_t) + MLPX_PRINTF_MAX + 1);	/* may exit */
     m->next = 0;
+    m->refs = 0;
+    m->shr = 0;
 
     l = vsnprintf (m->data, MLPX_PRINTF_MAX + 1, fmt, ap);
     va_end(ap);
 
+    if (l < 0)
+	l = 0;
+    else if (l > MLPX_PRINTF_MAX) {
+	/* truncated, but still one line */
+	l = MLPX_PRINTF_MAX;
+	m->data[l - 1] = '\n';
+    }
+
     m->len = l;
     m->flags = flags | MF_PLAIN;	/* no prefix yet */
 
@@ -179,6 +922,14 @@ struct strlist *sl;
  */
 void mlpx_setup_ch (chn_t *ch)
 {
+    /* datagram sockets keep message boundaries */
+    if ((ch->cf->method.type == mtUNIX &&
+		(ch->cf->method.data & (MT_F_DGRAM|MT_F_SEQPKT))) ||
+					ch->cf->method.type == mtUDP)
+	ch->flags |= CHN_F_DGRAM;
+    else
+	ch->flags &= ~CHN_F_DGRAM;
+
     if (ch->flags & CHN_F_RD)
 	/* create the input buffer (and fdio) for this channel */
 	mlpx_add_reader (ch);
@@ -188,10 +939,13 @@ void mlpx_setup_ch (chn_t *ch)
     }
 
     /* open logfile if configured */
-    if (ch->cf->log)
+    if (ch->cf->log) {
         if((ch->log = open(ch->cf->log,O_WRONLY|O_APPEND|O_CREAT,0644)) == -1)
             mlpx_printf (CHN_MSG, MF_ERR, "logfile open: %s: %s\n",
                                                 ch->cf->log, strerror(errno));
+	else
+	    logw_add (ch->log);		/* written by the log thread */
+    }
 
     /* output channel message/motd here (if defined) */
     if (ch->cf->msg)
@@ -211,6 +965,21 @@ void mlpx_setup_ch (chn_t *ch)
  */
 void mlpx_cleanup_ch (chn_t *ch)
 {
+    /* remove links from/to this channel */
+    if (ch->link)
+	mlpx_unlink (ch);
+    if (ch->lsrc)
+	mlpx_unlink (ch->lsrc);
+
+    /* cancel pending refill for rate limit */
+    if (ch->tb && ch->tb->pend) {
+	(void) tesc_untimedev (&ch->tb->te);
+	ch->tb->pend = 0;
+    }
+
+    /* stop watching a followed file */
+    fwat_unfollow (ch);
+
     /* remove reader and write queue (if they exists) */
     (void) tesc_del_reader (ch);
     (void) tesc_del_wq (ch);		/* deletes fdio structure */
@@ -218,10 +987,11 @@ void mlpx_cleanup_ch (chn_t *ch)
     /* mark channel inactive */
     ch->flags = 0;
     ch->fd = -1;
+    ch->hold = 0;
 
     /* close/free/mark inactive for logfile (if open) */
     if (ch->log != -1) {
-	(void) close (ch->log);		/* FIXME? */
+	logw_close (ch->log);		/* after pending data */
 	ch->log = -1;
     }
 
@@ -268,13 +1038,22 @@ int id = ch->id;
 
 	/* special handling for 'popen' channels */
 	if (ch->flags & CHN_F_PROC)
-	    cmdi_inst_reaper (ch->pid);
+	    proc_reap (ch->pid);
 
-	mlpx_printf (CHN_MSG, 0, "EOF on channel %02x\n", ch->id);
+	mlpx_printf (CHN_MSG, 0, "EOF on channel %0*X\n", idlen, ch->id);
 	mlpx_printf (ch->id, MF_EOF, "\n");
 
 	/* channel is closed */
 	mlpx_cleanup_ch (ch);		/* resets all flags */
+
+	/* accepted connections go away with the connection */
+	if (ch->lsn) {
+	    mlpx_drop_chn (ch);
+	    return;
+	}
+
+	/* reopen it later (if configured) */
+	cmdi_reconnect (ch);
     }
 
     return;
@@ -289,6 +1068,9 @@ int id = ch->id;
 void mux (msg_t *m, const chn_t *ch)
 {
 char tc;
+char *cp;
+int i, id;
+chn_t *pc;
 
 #ifdef DEBUG
     if (! (m->flags & MF_PLAIN)) {
@@ -297,7 +1079,7 @@ char tc;
 	tesc_emerg (CHN_MSG, MF_EOF, "\n");
 	exit (1);
     }
-    if (ch->id < 0 || ch->id > CHN_MAX) {
+    if (ch->id < 0 || ch->id > mlpx_maxid()) {
 	/* illegal id */
         tesc_emerg (CHN_MSG, MF_ERR, "mux(): illegal id\n");
 	tesc_emerg (CHN_MSG, MF_EOF, "\n");
@@ -309,35 +1091,119 @@ char tc;
     tc = mlpx_prfxtc (m->flags);
 
     /* fill in prefix */
-    if (! chmap[ch->id]) {
+    if (! (pc = mlpx_id2chn (ch->id))) {
 	/* no such channel */
         tesc_emerg (CHN_MSG, MF_ERR, "mux(): no such channel\n");
 	tesc_emerg (CHN_MSG, MF_EOF, "\n");
 	exit (1);
     }
 #ifdef DEBUG
-    if (PRFXLEN != 5) {
+    if (PRFXLEN != idlen + 3 || PRFXLEN > PRFXMAX) {
 	/* huh! prefix length does not match the following part */
         tesc_emerg (CHN_MSG, MF_ERR, "mux(): internal error\n");
 	tesc_emerg (CHN_MSG, MF_EOF, "\n");
 	exit (1);
     }
 #endif
-    m->prefix[0] = tc;
-    m->prefix[1] = hexdigit (ch->id / 16);
-    m->prefix[2] = hexdigit (ch->id % 16);
-    m->prefix[3] = tc;
-    m->prefix[4] = ' ';
+    /* prefix is right aligned, directly in front of data */
+    cp = m->data - PRFXLEN;
+    cp[0] = tc;
+    for (i = idlen, id = ch->id; i > 0; --i, id /= 16)
+	cp[i] = hexdigit (id % 16);
+    cp[idlen + 1] = tc;
+    cp[idlen + 2] = ' ';
 
     m->flags &= ~MF_PLAIN;
     m->len += PRFXLEN;
 
-    /* and off to main out */
-    if (tesc_enq_wq (&ch_main_out, m)) {
-	/* failed */
-        tesc_emerg (CHN_MSG, MF_ERR, "mux(): test_enq_wq() failed\n");
-	tesc_emerg (CHN_MSG, MF_EOF, "\n");
-	exit (1);
+    /* append to the pending queue of the channel */
+    m->next = 0;
+    if (pc->pq) {
+	pc->pt->next = m;
+	pc->pt = m;
+    } else {
+	pc->pq = pc->pt = m;
+
+	/* channel becomes active, append to its lane (new turn) */
+	pc->deficit = (long) CHN_QUANTUM * pc->weight;
+	pc->pnext = 0;
+	if (lanes[pc->prio].tail)
+	    lanes[pc->prio].tail->pnext = pc;
+	else
+	    lanes[pc->prio].head = pc;
+	lanes[pc->prio].tail = pc;
+    }
+
+    /* and off to main out (if idle) */
+    if (tesc_wq_empty (&ch_main_out))
+	mainout_feed (&ch_main_out);
+
+    return;
+}
+
+
+/*
+ *	mainout_feed()	[private]
+ *
+ *	move the next messages (about CHN_QUANTUM bytes, so
+ *	they can be written at once) from the highest non-empty
+ *	lane(s) to the main output queue (called from mux()
+ *	and by tesc if the main output queue is drained)
+ *
+ *	in the lane, the channel at the head sends while its
+ *	deficit covers the next message. if not, its turn is
+ *	over: it gets another quantum and goes to the tail.
+ */
+static void mainout_feed (chn_t *ch)
+{
+msg_t *m;
+chn_t *pc;
+int i;
+long n;
+
+    for (n = 0; n < CHN_QUANTUM; n += m->len) {
+	m = 0;
+	for (i = 0; i < CHN_NPRIO && !m; ++i)
+	    while ((pc = lanes[i].head)) {
+		if (pc->deficit < (long) pc->pq->len) {
+		    /* turn is over, next one */
+		    pc->deficit += (long) CHN_QUANTUM * pc->weight;
+		    if (pc->pnext) {
+			lanes[i].head = pc->pnext;
+			lanes[i].tail->pnext = pc;
+			lanes[i].tail = pc;
+			pc->pnext = 0;
+			continue;
+		    }
+		    /* (alone in the lane: its next turn starts now) */
+		}
+
+		m = pc->pq;
+		pc->deficit -= m->len;
+		if (pc->deficit < 0)
+		    pc->deficit = 0;	/* (alone, msg > quantum) */
+		if (! (pc->pq = m->next)) {
+		    /* nothing more pending, remove from lane */
+		    pc->pt = 0;
+		    pc->deficit = 0;
+		    if (! (lanes[i].head = pc->pnext))
+			lanes[i].tail = 0;
+		    pc->pnext = 0;
+		    pc->hold &= ~CHN_H_BP;	/* may read again */
+		}
+		m->next = 0;
+		break;
+	    }
+
+	if (! m)
+	    break;	/* nothing pending */
+
+	if (tesc_enq_wq (ch, m)) {
+	    /* failed */
+	    tesc_emerg (CHN_MSG, MF_ERR, "mux(): test_enq_wq() failed\n");
+	    tesc_emerg (CHN_MSG, MF_EOF, "\n");
+	    exit (1);
+	}
     }
 
     return;
@@ -352,11 +1218,12 @@ char tc;
  */
 void demux (msg_t *m, const chn_t *ch /* unused */)
 {
-int id;
+int i, id;
+char *cp;
 (void)ch;/* avoid warnings */
 
 #ifdef DEBUG
-    if (PRFXLEN != 5) {
+    if (PRFXLEN != idlen + 3 || PRFXLEN > PRFXMAX) {
 	/* huh! prefix length does not match the following part */
         tesc_emerg (CHN_MSG, MF_ERR, "demux(): internal error\n");
         tesc_emerg (CHN_MSG, MF_EOF, "\n");
@@ -368,8 +1235,8 @@ int id;
 	exit (1);
     }
 #endif
-    if (m->len < 6) {
-	/* illegal input, expected at least prefix + '\n', i.e. len == 6 */
+    if (m->len < PRFXLEN + 1) {
+	/* illegal input, expected at least prefix + '\n' */
         mlpx_printf (CHN_MSG, MF_ERR,
 		"demux(): illegal input (too short to have valid prefix)\n");
 	free (m);
@@ -377,7 +1244,8 @@ int id;
     }
 
     /* check prefix */
-    if (m->prefix[0] != '<' || m->prefix[3] != '<' || m->prefix[4] != ' ') {
+    cp = m->data - PRFXLEN;
+    if (cp[0] != '<' || cp[idlen + 1] != '<' || cp[idlen + 2] != ' ') {
 	/* illegal prefix, wrong framing chars for id */
         mlpx_printf (CHN_MSG, MF_ERR,
 		"demux(): illegal prefix (wrong framing chars)\n");
@@ -385,37 +1253,37 @@ int id;
 	return;
     }
 
-    /* check id part */
-    if (! (ishexdigit (m->prefix[1]) && ishexdigit (m->prefix[2]))) { 
-	/* illegal char for prefix */
-        mlpx_printf (CHN_MSG, MF_ERR,
+    /* check id part and convert id */
+    for (i = 1, id = 0; i <= idlen; ++i) {
+	if (! ishexdigit (cp[i])) {
+	    /* illegal char for prefix */
+	    mlpx_printf (CHN_MSG, MF_ERR,
 		"demux(): illegal prefix (garbled channel id)\n");
-	free (m);
-	return;
+	    free (m);
+	    return;
+	}
+	id = id * 16 + hexd2int (cp[i]);
     }
 
-    /* convert id */
-    id = hexd2int (m->prefix[1]) * 16 + hexd2int (m->prefix[2]);
-
     /* check if channel is valid and open for writing */
-    if (! chmap[id]) {
+    if (! mlpx_id2chn (id)) {
 	/* channel does not exist */
         mlpx_printf (CHN_MSG, MF_ERR,
-		"demux(): channel %02X does not exist\n", id);
+		"demux(): channel %0*X does not exist\n", idlen, id);
 	free (m);
 	return;
     }
     if (chmap[id]->flags & CHN_F_IP) {
 	/* open/connect still in progress */
 	mlpx_printf (CHN_MSG, MF_ERR,
-		"demux(): channel %02X not yet ready\n", id);
+		"demux(): channel %0*X not yet ready\n", idlen, id);
 	free (m);
 	return;
     }
     if (! (chmap[id]->flags & CHN_F_WR)) {
 	/* channel is not writeable */
         mlpx_printf (CHN_MSG, MF_ERR,
-		"demux(): channel %02X not open for writing\n", id);
+		"demux(): channel %0*X not open for writing\n", idlen, id);
 	free (m);
 	return;
     }
@@ -480,6 +1348,7 @@ struct chnlist *chli;
 	if ((logfd = open (cf->log, O_WRONLY|O_APPEND|O_CREAT, 0644)) == -1)
 	    tesc_emerg (CHN_MSG, MF_ERR, "logfile open: %s: %s\n",
 						cf->log, strerror(errno));
+    logw_add (logfd);
 
 
     /*
@@ -487,14 +1356,10 @@ struct chnlist *chli;
      */
 
     /* construct channel info */
+    mlpx_init_chn (&ch_main_in, CHN_MAIN, 0);	/* fake / not in chmap */
     ch_main_in.flags = CHN_F_RD;	/* read only */
-    ch_main_in.id = CHN_MAIN;		/* fake / not in chmap */
     ch_main_in.fd = 0;			/* use stdin */
     ch_main_in.log = logfd;
-    ch_main_in.pxfl = 0;
-    ch_main_in.cf = 0;			/* no config */
-    ch_main_in.timeout = 0;		/* no stall-detection */
-    ch_main_in.stalled = 0;
 
     b = data_new_buf (demux, 1, 0);	/* wait, !plain */
     tesc_add_reader (&ch_main_in, data_buf_input, b);
@@ -505,14 +1370,13 @@ struct chnlist *chli;
      */
 
     /* construct channel info */
+    mlpx_init_chn (&ch_main_out, CHN_MAIN, 0);	/* fake / not in chmap */
     ch_main_out.flags = CHN_F_WR;	/* write only */
-    ch_main_in.id = CHN_MAIN;		/* fake / not in chmap */
     ch_main_out.fd = 1;			/* use stdout */
     ch_main_out.log = logfd;
-    ch_main_out.pxfl = 0;
-    ch_main_out.cf = 0;
     ch_main_out.timeout = cf->timeout;	/* config:timeout for stall-detect */
     ch_main_out.stalled = mainout_stalled;
+    ch_main_out.drained = mainout_feed;
 
     tesc_enq_wq (&ch_main_out, 0);	/* 0 msg, to create fdio */
     tesc_keep (&ch_main_out);		/* do not delete fdio */
@@ -536,54 +1400,31 @@ struct chnlist *chli;
      *	config. here the channel ids are determined.
      */
 
-    /* clear map */
-    for (i = 0; i <= CHN_MAX; ++i)
-	chmap[i] = 0;
+    /* allocate (cleared) map */
+    chmap_grow (CHN_MAX);				/* may exit */
 
     /* insert command channel (fake) - used only as a marker in chmap */
-    chmap[CHN_CMD] = sec_malloc (sizeof(chn_t));	/* may exit */
-    chmap[CHN_CMD]->flags = CHN_F_WR;	/* for demux() */
-    chmap[CHN_CMD]->id = CHN_CMD;
-    chmap[CHN_CMD]->fd = -1;		/* not used */
-    chmap[CHN_CMD]->log = -1;		/* not used */
-    chmap[CHN_CMD]->pxfl = 0;		/* not used */
-    chmap[CHN_CMD]->cf = 0;		/* not used */
-    chmap[CHN_CMD]->timeout = 0;	/* not used */
-    chmap[CHN_CMD]->stalled = 0;	/* not used */
+    new_chn (CHN_CMD, 0)->flags = CHN_F_WR;	/* for demux() */
 
     /* insert msg channel (fake) - used only as a marker in chmap */
-    chmap[CHN_MSG] = sec_malloc (sizeof(chn_t));	/* may exit */
-    chmap[CHN_MSG]->flags = CHN_F_WR;	/* for demux() */
-    chmap[CHN_MSG]->id = CHN_MSG;
-    chmap[CHN_CMD]->fd = -1;		/* not used */
-    chmap[CHN_MSG]->log = -1;		/* not used */
-    chmap[CHN_MSG]->pxfl = 0;		/* not used */
-    chmap[CHN_MSG]->cf = 0;		/* not used */
-    chmap[CHN_CMD]->timeout = 0;	/* not used */
-    chmap[CHN_CMD]->stalled = 0;	/* not used */
+    new_chn (CHN_MSG, 0)->flags = CHN_F_WR;	/* for demux() */
 
     /* insert all defined channels */
     for (i = 0, chli = cf->channels; chli; chli = chli->next) {
 	if (i == CHN_CMD || i == CHN_MSG)	/* skip, already in use */
 	    ++i;
-	if (i > CHN_MAX) {
+	if (i > mlpx_maxid()) {
 	    /* too many channels defined */
-		/* FIXME */
+	    mlpx_printf (CHN_MSG, MF_ERR, "too many channels defined, "
+			"ignoring the rest%s\n", idlen == CHN_XIDLEN ? "" :
+			" (extended channel ids not enabled)");
 	    break;	/* skip the rest */
 	}
 	if (! chli->channel.enabled)
 	    continue;	/* incomplete / failed parse */
 
 	/* allocate chn_t / assign channel id */
-	chmap[i] = sec_malloc (sizeof(chn_t));		/* may exit */
-	chmap[i]->flags = 0;		/* not active */
-	chmap[i]->id = i;
-	chmap[i]->fd = -1;		/* closed */
-	chmap[i]->log = -1;		/* closed */
-	chmap[i]->pxfl = 0;
-	chmap[i]->cf = &chli->channel;
-	chmap[i]->timeout = 0;		/* disable */
-	chmap[i]->stalled = 0;
+	new_chn (i, &chli->channel);			/* may exit */
 	++i;
     }
 
@@ -595,15 +1436,16 @@ struct chnlist *chli;
 
     /* header */
     mlpx_printf (CHN_CMD, 0, "### UT VERSION %s ###\n", UT_VERSION);
-    mlpx_printf (CHN_CMD, 0, "CMD %02X MSG %02X\n", CHN_CMD, CHN_MSG);
+    mlpx_printf (CHN_CMD, 0, "CMD %0*X MSG %0*X\n",
+					idlen, CHN_CMD, idlen, CHN_MSG);
 
     /* available channels */
     mlpx_printf (CHN_CMD, 0, "CHANNELS:\n");
-    for (i = 0; i <= CHN_MAX; ++i) {
+    for (i = 0; i < chmapsiz; ++i) {
 	if (i == CHN_CMD || i == CHN_MSG)
 	    continue;	/* do not report these, they appeared in line 2 */
 	if (chmap[i])
-	    mlpx_printf (CHN_CMD, 0, "%02X %s \"%s\"\n", i,
+	    mlpx_printf (CHN_CMD, 0, "%0*X %s \"%s\"\n", idlen, i,
 					chmap[i]->cf->type, 
 					chmap[i]->cf->name);
     }
@@ -38,17 +38,47 @@
 /*	".XX. "		output from mux (closed)	*/
 /* XX can be anything from 00 to (hex for) CHN_MAX	*/
 /* but must fit in 2 chars				*/
+/*							*/
+/* extended prefixes (ut started with -x):		*/
+/*	"<XXXX< ", ">XXXX> ", ...			*/
+/* XXXX can be anything from 0000 to (hex for) CHN_XMAX	*/
+/* the prefix width is fixed for the whole session	*/
 
 /* CHN_MAX must must be < 0x100, since prefix allows only 2 digits (hex) */
 #define	CHN_MAX		0xff
+#define	CHN_XMAX	0xffff			/* max id, extended	*/
+#define	CHN_IDLEN	2			/* id digits		*/
+#define	CHN_XIDLEN	4			/* id digits, extended	*/
 #define CHN_MSG		CHN_MAX			/* debug/msg channel	*/
 #define CHN_CMD		0x00			/* command channel	*/
 #define CHN_MAIN	-1			/* fake - main in/out	*/
+#define CHN_INT		-2			/* fake - internal use	*/
+
+/* priority classes (lanes) on the main output, 0 is served first */
+/* (config: "priority 1" .. "priority CHN_NPRIO")		   */
+#define CHN_NPRIO	4			/* number of lanes	*/
+#define CHN_PRIO_DEF	1			/* default lane		*/
+#define CHN_PRIO_TOP	0			/* lane for CMD/MSG	*/
+
+/* within a lane channels are served by deficit round robin,	*/
+/* each turn a channel may send CHN_QUANTUM * weight bytes	*/
+#define CHN_QUANTUM	4096			/* bytes per turn	*/
+#define CHN_WMAX	64			/* max weight		*/
 
 
 /* timeout function (for stall-detection) */
 typedef struct chn_ chn_t;
 typedef void (*tofun_t) (chn_t *);
+struct msg_;
+struct filtst;
+struct tbucket;
+struct inetop;
+struct recon;
+struct opento;
+struct bulk;
+struct ppool;
+struct fwat;
+struct aopen;
 
 
 /*
@@ -63,15 +93,20 @@ struct chn_ {
 #define CHN_F_CIP	0x0020			/* connect in progress	*/
 #define CHN_F_IP	(CHN_F_OIP|CHN_F_CIP)	/* ^^ in progress	*/
 #define CHN_F_PROC	0x0040			/* channel to process	*/
+#define CHN_F_RES	0x0080			/* resolving host name	*/
+#define CHN_F_ATT	0x0004			/* connect attempts	*/
+#define CHN_F_PEND	(CHN_F_RES|CHN_F_ATT)	/* open pending, no fd	*/
+#define CHN_F_RCW	0x0008			/* waiting to reconnect	*/
 #define CHN_ERR_R	0x0100			/* read error on fd	*/
 #define CHN_ERR_W	0x0200			/* write error on fd	*/
 #define CHN_ERR_L	0x0400			/* write error on log	*/
 #define CHN_ERR_P	0x0800			/* see pxfl		*/
 #define CHN_ERROR	(CHN_ERR_R | CHN_ERR_W | CHN_ERR_L | CHN_ERR_P)
 #define CHN_EOF		0x1000			/* EOF on fd		*/
+#define CHN_F_DGRAM	0x2000			/* msg per datagram	*/
 #define CHN_NEED_UPD	(CHN_ERROR | CHN_EOF)	/* update required	*/
 	int	flags;			/* (see above)			*/
-	int	id;			/* 0 upto CHN_MAX		*/
+	int	id;			/* 0 upto CHN_MAX (CHN_XMAX)	*/
 	int	fd;			/* passed to tesc/fdio		*/
 	int	log;			/* logfile (if enabled)		*/
 	pid_t	pid;			/* pid from method popen	*/
@@ -82,11 +117,52 @@ struct chn_ {
 	struct channel	*cf;		/* config			*/
 	int		timeout;	/* s-d timeout, enable if > 0	*/
 	tofun_t		stalled;	/* called is above is reached	*/
-	/* filter hook? */
+	struct filtst	*fst;		/* filter state (if cf->filter)	*/
+	int		prio;		/* lane on main out (0 .. )	*/
+	int		weight;		/* share within lane (>= 1)	*/
+	long		deficit;	/* DRR: # of bytes left to send	*/
+	struct msg_	*pq;		/* pending for main out (head)	*/
+	struct msg_	*pt;		/*    -- " --           (tail)	*/
+	chn_t		*pnext;		/* next channel in lane		*/
+	tofun_t		drained;	/* called if wq becomes empty	*/
+#define CHN_H_LINK	0x0001			/* link pipe is full	*/
+#define CHN_H_RATE	0x0002			/* out of rate tokens	*/
+#define CHN_H_BP	0x0004			/* main out backlog	*/
+#define CHN_H_EOF	0x0008			/* at end of followed file */
+	int		hold;		/* input suspended if != 0	*/
+	unsigned long	nrd;		/* # of bytes read from fd	*/
+	unsigned long	nwr;		/* # of bytes written to fd	*/
+	chn_t		*link;		/* input is relayed to 'link'	*/
+	chn_t		*lsrc;		/* channel linked to this one	*/
+	int		lp[2];		/* pipe for splice() or -1	*/
+	int		lpend;		/* # of bytes in 'lp'		*/
+	struct msg_	*lmark;		/* splice marker in link's wq	*/
+	struct tbucket	*tb;		/* rate limit (if cf->rl...)	*/
+	struct inetop	*iop;		/* inet open in progress	*/
+	struct recon	*rc;		/* reconnect state (or 0)	*/
+	struct opento	*oto;		/* open timeout (or 0)		*/
+	struct bulk	*blk;		/* bulk open it belongs to	*/
+	char		*tag;		/* request tag of open (or 0)	*/
+	struct ppool	*pp;		/* idle processes (or 0)	*/
+	struct fwat	*fw;		/* followed file (or 0)		*/
+	struct aopen	*ao;		/* autoopen state (or 0)	*/
+	chn_t		*lsn;		/* listener (if accepted)	*/
+	int		nacc;		/* # of accepted connections	*/
+	off_t		roff;		/* read method: next offset	*/
 };
 
 
+extern void mlpx_set_xid (int);
+extern int mlpx_idlen ();
+extern int mlpx_maxid ();
+extern int mlpx_topid ();
+extern void mlpx_init_chn (chn_t *, int, struct channel *);
+extern chn_t *mlpx_new_chn (struct channel *);
+extern int mlpx_del_chn (chn_t *);
+extern void mlpx_drop_chn (chn_t *);
 extern chn_t *mlpx_id2chn (int);
+extern void mlpx_link (chn_t *, chn_t *);
+extern void mlpx_unlink (chn_t *);
 extern void mlpx_add_reader (chn_t *);
 extern char mlpx_prfxtc (int);
 extern void mlpx_cmd ();
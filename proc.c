@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2026 bytemine GmbH <info@bytemine.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ *	ut: proc.c
+ *
+ *	child process handling
+ *
+ *	SIGCHLD is delivered into the scheduler through a
+ *	self-pipe, read with a fake channel. each time it
+ *	becomes readable, all processes of closed channels
+ *	(and idle pool processes, see cmdi.c) are checked
+ *	with waitpid(), so exits are noticed immediately.
+ *	processes which do not exit after their channel is
+ *	closed get SIGHUP, SIGTERM and finally SIGKILL from
+ *	a timed event.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "conf.h"
+#include "mlpx.h"
+#include "data.h"
+#include "tesc.h"
+#include "cmdi.h"
+#include "proc.h"
+
+
+#define PROC_GRACE	1000		/* ms until the first signal	*/
+
+
+/* process of a closed channel, waiting to be reaped */
+struct dying {
+	struct dying	*next;
+	pid_t		pid;
+	int		step;		/* next signal to send		*/
+	timedev_t	te;		/* signal escalation		*/
+	int		tepend;		/* 'te' is scheduled		*/
+};
+
+
+static struct dying *dying = 0;		/* processes to reap		*/
+static int spipe[2] = { -1, -1 };	/* SIGCHLD handler -> scheduler	*/
+static chn_t proc_ch;			/* fake channel for spipe[0]	*/
+
+
+/*
+ *	sigchld()		[private]
+ *
+ *	signal handler: wake up the scheduler
+ */
+static void sigchld (int sig)
+{
+int e = errno;
+
+    (void) sig;
+    (void) write (spipe[1], "", 1);	/* pipe full is fine */
+
+    errno = e;
+
+    return;
+}
+
+
+/*
+ *	proc_check()
+ *
+ *	check if process 'p' has terminated, output its status
+ *
+ *	returns 1 if done, 0 if still running
+ */
+int proc_check (pid_t p)
+{
+pid_t pid;
+int status = 0;
+
+    if ((pid = waitpid (p, &status, WNOHANG)) == -1) {
+	mlpx_printf (CHN_MSG, MF_ERR, "waitpid(): %s\n", strerror(errno));
+	return errno == ECHILD;		/* not ours (any more) */
+    }
+
+    if (! pid)
+	return 0;
+
+    if (WIFSTOPPED(status)) {
+	mlpx_printf (CHN_MSG, 0, "pid %u stopped\n", pid);
+	return 0;
+    } else if (WIFSIGNALED(status)) {
+	mlpx_printf (CHN_MSG, 0, "pid %u terminated by signal %d%s\n",
+				pid, WTERMSIG(status),
+				WCOREDUMP(status) ? " core dumped" : "");
+    } else if (WIFEXITED(status)) {
+	mlpx_printf (CHN_MSG, 0, "pid %u exited (%d)\n",
+					pid, WEXITSTATUS(status));
+    } else {
+	/* should not happen */
+	mlpx_printf (CHN_MSG, MF_ERR, "unknown status code "
+				"0x%08x for pid %u\n", status, pid);
+	/* we ignore the pid from now on */
+    }
+
+    return 1;
+}
+
+
+/*
+ *	drop()			[private]
+ *
+ *	remove 'd' from the list, free it
+ */
+static void drop (struct dying *d)
+{
+struct dying **dp;
+
+    for (dp = &dying; *dp; dp = &(*dp)->next)
+	if (*dp == d) {
+	    *dp = d->next;
+	    break;
+	}
+
+    if (d->tepend)
+	tesc_untimedev (&d->te);
+    free (d);
+
+    return;
+}
+
+
+/*
+ *	escalate()		[private]
+ *
+ *	timed event for a process which refuses to die:
+ *	send the next signal
+ */
+static void escalate (timedev_t *te)
+{
+struct dying *d = te->data;
+static const struct {
+	int		sig;
+	const char	*name;
+	int		next;		/* ms until next step		*/
+} steps[] = {
+	{ SIGHUP,  "SIGHUP",  10000 },	/* its /bin/sh */
+	{ SIGTERM, "SIGTERM", 20000 },
+	{ SIGKILL, "SIGKILL", 10000 }
+};
+int i;
+
+    d->tepend = 0;
+
+    /* in case the SIGCHLD got lost */
+    if (proc_check (d->pid)) {
+	drop (d);
+	return;
+    }
+
+    if ((i = d->step) < 3) {
+	mlpx_printf (CHN_MSG, 0, "sending %s to %u\n",
+						steps[i].name, d->pid);
+	if (kill (d->pid, steps[i].sig) == -1)
+	    mlpx_printf (CHN_MSG, MF_ERR, "kill() pid %u: %s\n",
+						d->pid, strerror(errno));
+	++d->step;
+    } else
+	i = 2;		/* already sent SIGKILL, check again later */
+
+    te->inms = steps[i].next;
+    if (! tesc_timedev (te))
+	d->tepend = 1;
+
+    return;
+}
+
+
+/*
+ *	proc_input()		[private]
+ *
+ *	input function for the SIGCHLD pipe: reap all
+ *	terminated processes
+ */
+static int proc_input (int fd, buf_t *b, chn_t *ch)
+{
+char buf[64];
+struct dying *d, *next;
+
+    (void) b;
+    (void) ch;
+
+    while (read (fd, buf, sizeof buf) > 0)
+	;	/* drain */
+
+    for (d = dying; d; d = next) {
+	next = d->next;
+	if (proc_check (d->pid))
+	    drop (d);
+    }
+
+    /* idle processes of popen pools */
+    cmdi_pool_reap ();
+
+    return 0;
+}
+
+
+/*
+ *	proc_init()
+ *
+ *	setup SIGCHLD handling
+ */
+void proc_init (void)
+{
+struct sigaction sa;
+int i, fdfl;
+
+    if (pipe (spipe) == -1) {
+	tesc_emerg (CHN_MSG, MF_ERR, "proc: pipe(): %s\n", strerror(errno));
+	tesc_emerg (CHN_MSG, MF_EOF, "\n");
+	exit (EXIT_FAILURE);
+    }
+    for (i = 0; i < 2; ++i) {
+	(void) fcntl (spipe[i], F_SETFD, FD_CLOEXEC);
+	if ((fdfl = fcntl (spipe[i], F_GETFL)) != -1)
+	    (void) fcntl (spipe[i], F_SETFL, fdfl | O_NONBLOCK);
+    }
+
+    /* fake channel for the scheduler */
+    mlpx_init_chn (&proc_ch, CHN_INT, 0);
+    proc_ch.flags = CHN_F_RD;
+    proc_ch.fd = spipe[0];
+    tesc_add_reader (&proc_ch, proc_input, 0);
+
+    memset (&sa, 0, sizeof sa);
+    sa.sa_handler = sigchld;
+    sigemptyset (&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    if (sigaction (SIGCHLD, &sa, 0) == -1) {
+	tesc_emerg (CHN_MSG, MF_ERR, "sigaction(): %s\n", strerror(errno));
+	tesc_emerg (CHN_MSG, MF_EOF, "\n");
+	exit (EXIT_FAILURE);
+    }
+
+    return;
+}
+
+
+/*
+ *	proc_reap()
+ *
+ *	collect the exit status of process 'pid' (of a
+ *	closed channel), use signals if it refuses to die
+ */
+void proc_reap (pid_t pid)
+{
+struct dying *d;
+
+    d = sec_malloc (sizeof(struct dying));		/* may exit */
+    d->pid = pid;
+    d->step = 0;
+    d->tepend = 0;
+
+    if (proc_check (d->pid)) {
+	free (d);
+	return;
+    }
+
+    d->next = dying;
+    dying = d;
+
+    d->te.inms = PROC_GRACE;
+    d->te.func = escalate;
+    d->te.data = d;
+    if (! tesc_timedev (&d->te))
+	d->tepend = 1;
+
+    return;
+}
+
+
+/*** end ***/
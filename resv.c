@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2026 bytemine GmbH <info@bytemine.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ *	ut: resv.c
+ *
+ *	asynchronous host name resolution
+ *
+ *	getaddrinfo() blocks, so it is run by a small pool of
+ *	resolver threads (started on first use). finished
+ *	requests are posted back through a pipe, which is
+ *	read by the scheduler like any other channel (using
+ *	a fake channel). so everything except getaddrinfo()
+ *	itself runs in the main thread.
+ *
+ *	results are cached for RESV_TTL (RESV_NTTL for
+ *	failures) seconds. requests for a name which is
+ *	already being resolved wait for that result. expired
+ *	entries are freed whenever new results come in.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "conf.h"
+#include "mlpx.h"
+#include "data.h"
+#include "tesc.h"
+#include "resv.h"
+
+
+#define RESV_NTHREADS	2		/* # of resolver threads	*/
+#define RESV_TTL	60		/* cache time for results	*/
+#define RESV_NTTL	10		/* cache time for failures	*/
+
+
+/* client waiting for a result */
+struct rwait {
+	struct rwait	*next;
+	resvfun_t	fun;		/* callback			*/
+	void		*data;		/* client data			*/
+};
+
+/* cache entry (and request while pending) */
+struct rce {
+	struct rce	*next;		/* next in cache		*/
+	struct rce	*qnext;		/* next in request queue	*/
+	char		*host;		/* name to resolve		*/
+	struct addrinfo	*ai;		/* result (if !err)		*/
+	int		err;		/* getaddrinfo() result		*/
+	time_t		expires;	/* end of cache time		*/
+	int		pend;		/* being resolved		*/
+	struct rwait	*wait;		/* clients waiting for result	*/
+};
+
+
+static struct rce *cache = 0;		/* cached names			*/
+static int started = 0;			/* threads are running		*/
+static int rpipe[2];			/* worker -> scheduler		*/
+static chn_t resv_ch;			/* fake channel for rpipe[0]	*/
+
+/* request queue, shared with the worker threads */
+static pthread_mutex_t rq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rq_cond = PTHREAD_COND_INITIALIZER;
+static struct rce *rq_head = 0;
+static struct rce *rq_tail = 0;
+
+
+/*
+ *	resv_worker()	[private]
+ *
+ *	resolver thread: resolve queued names, post the
+ *	entry to the scheduler when done
+ */
+static void *resv_worker (void *arg)
+{
+struct rce *e;
+struct addrinfo hints;
+
+    (void) arg;
+
+    for (;;) {
+	pthread_mutex_lock (&rq_lock);
+	while (! rq_head)
+	    pthread_cond_wait (&rq_cond, &rq_lock);
+	e = rq_head;
+	if (! (rq_head = e->qnext))
+	    rq_tail = 0;
+	pthread_mutex_unlock (&rq_lock);
+
+	memset (&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	e->ai = 0;
+	e->err = getaddrinfo (e->host, 0, &hints, &e->ai);
+
+	/* (pointer sized writes to a pipe are atomic) */
+	while (write (rpipe[1], &e, sizeof e) == -1 && errno == EINTR)
+	    ;
+    }
+
+    return 0;	/* not reached */
+}
+
+
+/*
+ *	cache_prune()	[private]
+ *
+ *	free the expired entries nobody waits for, so names
+ *	which are not looked up again do not pile up
+ */
+static void cache_prune (void)
+{
+struct rce *e, **ep;
+time_t now = time (0);
+
+    for (ep = &cache; (e = *ep); )
+	if (! e->pend && ! e->wait && e->expires <= now) {
+	    *ep = e->next;
+	    if (e->ai)
+		freeaddrinfo (e->ai);
+	    free (e->host);
+	    free (e);
+	} else
+	    ep = &e->next;
+
+    return;
+}
+
+
+/*
+ *	resv_input()	[private]
+ *
+ *	input function for the result pipe: update the cache
+ *	and notify the waiting clients (expired entries are
+ *	dropped first, results in use are not touched)
+ */
+static int resv_input (int fd, buf_t *b, chn_t *ch)
+{
+struct rce *ev[16];
+struct rwait *w;
+ssize_t n;
+int i;
+
+    (void) b;
+    (void) ch;
+
+    if ((n = read (fd, ev, sizeof ev)) == -1) {
+	if (errno != EAGAIN && errno != EINTR)
+	    mlpx_printf (CHN_MSG, MF_ERR, "resv_input(): read(): %s\n",
+							strerror(errno));
+	return 0;
+    }
+
+    cache_prune ();
+
+    for (i = 0; i < (int) (n / sizeof ev[0]); ++i) {
+	ev[i]->pend = 0;
+	ev[i]->expires = time (0) + (ev[i]->err ? RESV_NTTL : RESV_TTL);
+
+	while ((w = ev[i]->wait)) {
+	    ev[i]->wait = w->next;
+	    w->fun (ev[i]->err ? 0 : ev[i]->ai, ev[i]->err, w->data);
+	    free (w);
+	}
+    }
+
+    return 0;
+}
+
+
+/*
+ *	resv_start()	[private]
+ *
+ *	setup result pipe and start the resolver threads
+ *
+ *	returns 0 on success, -1 on error
+ */
+static int resv_start (void)
+{
+pthread_t t;
+sigset_t all, old;
+int i, n, fdfl;
+
+    if (pipe (rpipe) == -1) {
+	mlpx_printf (CHN_MSG, MF_ERR, "resolver: pipe(): %s\n",
+							strerror(errno));
+	return -1;
+    }
+    for (i = 0; i < 2; ++i)
+	(void) fcntl (rpipe[i], F_SETFD, FD_CLOEXEC);
+    if ((fdfl = fcntl (rpipe[0], F_GETFL)) != -1)
+	(void) fcntl (rpipe[0], F_SETFL, fdfl | O_NONBLOCK);
+
+    /* the threads must not get any signals */
+    sigfillset (&all);
+    pthread_sigmask (SIG_BLOCK, &all, &old);
+    for (i = 0, n = 0; i < RESV_NTHREADS; ++i)
+	if (pthread_create (&t, 0, resv_worker, 0) == 0) {
+	    pthread_detach (t);
+	    ++n;
+	}
+    pthread_sigmask (SIG_SETMASK, &old, 0);
+
+    if (!n) {
+	mlpx_printf (CHN_MSG, MF_ERR, "resolver: cannot start threads\n");
+	(void) close (rpipe[0]);
+	(void) close (rpipe[1]);
+	return -1;
+    }
+
+    /* fake channel for the scheduler */
+    mlpx_init_chn (&resv_ch, CHN_INT, 0);
+    resv_ch.flags = CHN_F_RD;
+    resv_ch.fd = rpipe[0];
+    tesc_add_reader (&resv_ch, resv_input, 0);
+
+    started = 1;
+
+    return 0;
+}
+
+
+/*
+ *	resv_lookup()
+ *
+ *	resolve 'host' (IPv4 and IPv6 addresses)
+ *
+ *	returns:
+ *	   0 -- cached result in '*aip' (owned by the cache,
+ *		valid until control returns to the scheduler)
+ *	  -1 -- failed, getaddrinfo() error in '*errp'
+ *	  -2 -- in progress, 'fun' is called with the result
+ *		(addresses or 0, error, 'data') later
+ */
+int resv_lookup (const char *host, const struct addrinfo **aip, int *errp,
+						resvfun_t fun, void *data)
+{
+struct rce *e;
+struct rwait *w, **wp;
+
+    for (e = cache; e; e = e->next)
+	if (! strcmp (e->host, host))
+	    break;
+
+    if (e && !e->pend && e->expires > time (0)) {
+	/* cached */
+	if (e->err) {
+	    *errp = e->err;
+	    return -1;
+	}
+	*aip = e->ai;
+	return 0;
+    }
+
+    if (! started && resv_start () == -1) {
+	*errp = EAI_SYSTEM;
+	return -1;
+    }
+
+    if (! e) {
+	/* new entry */
+	e = sec_malloc (sizeof(struct rce));		/* may exit */
+	e->host = sec_malloc (strlen (host) + 1);	/* may exit */
+	strcpy (e->host, host);
+	e->ai = 0;
+	e->err = 0;
+	e->pend = 0;
+	e->wait = 0;
+	e->next = cache;
+	cache = e;
+    }
+
+    /* wait for the result */
+    w = sec_malloc (sizeof(struct rwait));		/* may exit */
+    w->fun = fun;
+    w->data = data;
+    w->next = 0;
+    for (wp = &e->wait; *wp; wp = &(*wp)->next)
+	;
+    *wp = w;
+
+    if (! e->pend) {
+	/* (expired or new) resolve (again) */
+	if (e->ai)
+	    freeaddrinfo (e->ai);
+	e->ai = 0;
+	e->pend = 1;
+	e->qnext = 0;
+
+	pthread_mutex_lock (&rq_lock);
+	if (rq_tail)
+	    rq_tail->qnext = e;
+	else
+	    rq_head = e;
+	rq_tail = e;
+	pthread_cond_signal (&rq_cond);
+	pthread_mutex_unlock (&rq_lock);
+    }
+
+    return -2;	/* in progress */
+}
+
+
+/*
+ *	resv_cancel()
+ *
+ *	forget all clients waiting with 'data' (the lookup
+ *	itself goes on, its result is still cached)
+ */
+void resv_cancel (void *data)
+{
+struct rce *e;
+struct rwait *w, **wp;
+
+    for (e = cache; e; e = e->next)
+	for (wp = &e->wait; (w = *wp); )
+	    if (w->data == data) {
+		*wp = w->next;
+		free (w);
+	    } else
+		wp = &w->next;
+
+    return;
+}
+
+
+/*** end ***/
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2026 bytemine GmbH <info@bytemine.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef RESV_H
+#define RESV_H
+/*
+ *	ut: resv.h
+ *
+ *	asynchronous host name resolution
+ */
+
+/* needs <netdb.h> */
+
+
+/* result callback: addresses (or 0), getaddrinfo() error, client data */
+typedef void (*resvfun_t) (const struct addrinfo *, int, void *);
+
+extern int resv_lookup (const char *, const struct addrinfo **, int *,
+							resvfun_t, void *);
+extern void resv_cancel (void *);
+
+
+#endif /* ! RESV_H */
@@ -38,7 +38,8 @@
  *				[ filter -> ] (cmd-in | writeq/channel-fd)
  *
  *	- from sub (channel) input
- *		fd -> buf -> [ filter -> ] mux -> writeq/main-fd
+ *		fd -> buf -> [ filter -> ] (mux -> writeq/main-fd |
+ *					writeq/linked channel-fd)
  *
  * 	- (any) writeq -> fd
  *
@@ -46,12 +47,18 @@
  *	furthermore: timed events called from here
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE		/* splice() */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/uio.h>
+#include <sys/socket.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <poll.h>
 #include <time.h>
@@ -63,6 +70,7 @@
 #include "data.h"
 #include "tesc.h"
 #include "cmdi.h"
+#include "logw.h"
 
 #ifndef INFTIM
 #define INFTIM -1
@@ -97,11 +105,15 @@ struct fdiodli {
 
 
 /* each channel can have 2 fds (actual channel and logfile) and they're	*/
-/* allocated from the bottom (filling up 'holes'). so we allow for	*/
-/* 2 * (CHN_MAX + 1) plus a small amount (8) to get away with a static	*/
-/* fd -> fdio mapping table						*/
+/* allocated from the bottom (filling up 'holes'). so we start with	*/
+/* 2 * (CHN_MAX + 1) plus a small amount (8) for the fd -> fdio mapping	*/
+/* table, it is grown on demand (extended channel ids)			*/
 #define	FDMAPSIZ	(2 * CHN_MAX + 10)
 
+/* max # of queued msgs written at once */
+#define	WRITE_IOVMAX	64
+#define	DGRAM_BATCH	16		/* max datagrams per sendmmsg()	*/
+
 
 /*
  *	timed event queue (scheduler data)
@@ -116,7 +128,8 @@ struct teqi {
  *	main scheduler data
  */
 struct tesc {
-	struct fdio	*fdio[FDMAPSIZ];	/* all possible fdios 	*/
+	struct fdio	**fdio;			/* all possible fdios 	*/
+	int		fdmapsiz;		/* size of 'fdio'	*/
 	struct fdiodli	*ring;			/* ring of active fdios	*/
 	int 		numact;			/* # of active fdios	*/
 	struct teqi	*teq;			/* timed event queue	*/
@@ -213,6 +226,208 @@ struct fdio *tmp;
 }
 
 
+/*
+ *	splice_out()	-- move linked data from the link pipe of the
+ *	[private]	   source channel to 'fd' (head of 'wq' is the
+ *			   splice marker). marker is removed when
+ *			   the pipe is empty.
+ *
+ *	returns 0 on success, -1 on error
+ */
+static int splice_out (int fd, struct fdio *fdio)
+{
+chn_t *src = fdio->ch->lsrc;
+ssize_t l;
+msg_t *m;
+
+#ifdef __linux__
+    l = splice (src->lp[0], 0, fd, 0, src->lpend,
+				SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+    if (l == -1)
+	return (errno == EAGAIN ? 0 : -1);
+#else
+    (void) fd;
+    errno = ENOSYS;
+    return -1;		/* not reached, no markers without splice() */
+#endif
+
+    fdio->ch->nwr += l;
+    src->lpend -= l;
+    src->hold &= ~CHN_H_LINK;	/* there's room in the pipe again */
+
+    if (! src->lpend) {
+	/* pipe drained, remove marker */
+	m = fdio->wq;
+	fdio->wq = m->next;
+	src->lmark = 0;
+	data_free_msg (m);
+	if (!fdio->wq) {
+	    fdio->wt = 0;
+	    if (fdio->ch->drained)
+		fdio->ch->drained (fdio->ch);
+	}
+    }
+
+    return 0;
+}
+
+
+/*
+ *	dgram_out()	-- send msgs from 'wq' to 'fd', one datagram
+ *	[private]	   each (w/o the trailing '\n'), batched with
+ *			   sendmmsg() where available
+ *
+ *	returns # of bytes sent, -1 on error
+ */
+static ssize_t dgram_out (int fd, struct fdio *fdio)
+{
+struct iovec iov[DGRAM_BATCH];
+#ifdef __linux__
+struct mmsghdr mh[DGRAM_BATCH];
+#else
+ssize_t l;
+#endif
+ssize_t r = 0;
+msg_t *m;
+int i, n;
+
+    for (n = 0, m = fdio->wq; m && n < DGRAM_BATCH; m = m->next, ++n) {
+	iov[n].iov_base = MSG_HEAD(m);
+	iov[n].iov_len = m->len;
+	if (m->len && MSG_HEAD(m)[m->len - 1] == '\n')
+	    --iov[n].iov_len;
+    }
+
+#ifdef __linux__
+    memset (mh, 0, n * sizeof(*mh));
+    for (i = 0; i < n; ++i) {
+	mh[i].msg_hdr.msg_iov = &iov[i];
+	mh[i].msg_hdr.msg_iovlen = 1;
+    }
+    if ((n = sendmmsg (fd, mh, n, MSG_DONTWAIT)) == -1)
+	return errno == EAGAIN ? 0 : -1;
+    for (i = 0; i < n; ++i)
+	r += mh[i].msg_len;
+#else
+    for (i = 0; i < n; ++i) {
+	if ((l = send (fd, iov[i].iov_base, iov[i].iov_len, 0)) == -1) {
+	    if (i)
+		break;
+	    return errno == EAGAIN ? 0 : -1;
+	}
+	r += l;
+    }
+    n = i;
+#endif
+
+    fdio->ch->nwr += r;
+
+    /* remove what was sent */
+    for (i = 0; i < n; ++i) {
+	m = fdio->wq;
+
+	if (fdio->ch->log != -1)
+	    tesc_log (m, fdio->ch, LOG_DIR_OUT);
+
+	fdio->wq = m->next;
+	data_free_msg (m);
+    }
+
+    if (!fdio->wq) {
+	fdio->wt = 0;
+	if (fdio->ch->drained)
+	    fdio->ch->drained (fdio->ch);
+    }
+
+    return r;
+}
+
+
+/*
+ *	write_out()	-- write as much of 'wq' as possible to 'fd'
+ *	[private]	   with a single writev() (up to the next
+ *			   splice marker), remove msgs which are
+ *			   completely out. 'fd' must be non-blocking,
+ *			   a short write is continued next time.
+ *
+ *	returns # of bytes written, -1 on error
+ */
+static ssize_t write_out (int fd, struct fdio *fdio)
+{
+struct iovec iov[WRITE_IOVMAX];
+ssize_t l, r;
+msg_t *m;
+int n;
+
+    if (fdio->ch->flags & CHN_F_DGRAM)
+	return dgram_out (fd, fdio);
+
+    for (n = 0, m = fdio->wq; m && n < WRITE_IOVMAX; m = m->next, ++n) {
+	if (m->flags & MF_SPLICE)
+	    break;	/* data is not in the msg */
+	iov[n].iov_base = MSG_HEAD(m);
+	iov[n].iov_len = m->len;
+    }
+    iov[0].iov_base = (char*) iov[0].iov_base + fdio->bw;
+    iov[0].iov_len -= fdio->bw;
+
+    if ((r = writev (fd, iov, n)) == -1)
+	return (errno == EAGAIN ? 0 : -1);	/* (less room than poll() said) */
+
+    fdio->ch->nwr += r;
+
+    /* remove what is completely out */
+    l = r + fdio->bw;
+    while ((m = fdio->wq) && ! (m->flags & MF_SPLICE) && l >= (ssize_t) m->len) {
+	l -= m->len;
+
+	if (fdio->ch->log != -1)
+	    tesc_log (m, fdio->ch, LOG_DIR_OUT);
+
+	fdio->wq = m->next;
+	data_free_msg (m);
+    }
+    fdio->bw = l;	/* part of the (new) head already out */
+
+    if (!fdio->wq) {
+	fdio->wt = 0;
+	/* let the channel refill the queue */
+	if (fdio->ch->drained)
+	    fdio->ch->drained (fdio->ch);
+    }
+
+    return r;
+}
+
+
+/*
+ *	fdmap_grow()	-- make sure 'fd' fits in the fd -> fdio map
+ *	[private]
+ */
+static void fdmap_grow (int fd)
+{
+int i, n;
+struct fdio **tmp;
+
+    if (fd < schdat.fdmapsiz)
+	return;
+
+    for (n = schdat.fdmapsiz ? schdat.fdmapsiz : FDMAPSIZ; n <= fd; n *= 2)
+	;
+
+    tmp = sec_malloc (n * sizeof(*tmp));		/* may exit */
+    for (i = 0; i < n; ++i)
+	tmp[i] = i < schdat.fdmapsiz ? schdat.fdio[i] : 0;
+
+    if (schdat.fdio)
+	free (schdat.fdio);
+    schdat.fdio = tmp;
+    schdat.fdmapsiz = n;
+
+    return;
+}
+
+
 /*
  *	tesc_emerg()
  *
@@ -246,9 +461,10 @@ time_t st, ct;
 
     siz = sizeof(buf);
 
-    if (schdat.fdio[1] && schdat.fdio[1]->bw) {
+    if (schdat.fdmapsiz > 1 && schdat.fdio[1] && schdat.fdio[1]->bw) {
 	/* incomplete line written, insert '\n' before output */
-	l = snprintf (buf, siz, "\n!%02X! output interrupted\n", CHN_MSG);
+	l = snprintf (buf, siz, "\n!%0*X! output interrupted\n",
+						mlpx_idlen(), CHN_MSG);
 	cp = buf + l;
 	siz -= l;
 	/* now reset the buffer of the current output msg_t	*/
@@ -263,7 +479,7 @@ time_t st, ct;
     tc = mlpx_prfxtc (flags);
 
     /* put prefix to buf */
-    l = snprintf (cp, siz, "%c%02X%c ", tc, id, tc);
+    l = snprintf (cp, siz, "%c%0*X%c ", tc, mlpx_idlen(), id, tc);
     cp += l;
     siz -= l;
 
@@ -323,10 +539,11 @@ int tesc_add_reader (chn_t *ch, bfifun_t rf, buf_t *b)
 {
 int fd = ch->fd;
 
-    if (fd < 0 || fd >= FDMAPSIZ) {
+    if (fd < 0) {
 	/* illegal fd */
 	return -1;
     }
+    fdmap_grow (fd);					/* may exit */
 
     if (schdat.fdio[fd]) {
 	/* fdio structure already exists */
@@ -373,7 +590,7 @@ int tesc_del_reader (const chn_t *ch)
 {
 int fd = ch->fd;
 
-    if (fd < 0 || fd >= FDMAPSIZ) {
+    if (fd < 0 || fd >= schdat.fdmapsiz) {
 	/* illegal fd */
 	return -1;
     }
@@ -417,7 +634,7 @@ int fd = ch->fd;
  */
 void tesc_keep (const chn_t *ch)
 {
-    if (ch->fd < 0 || ch->fd >= FDMAPSIZ)
+    if (ch->fd < 0 || ch->fd >= schdat.fdmapsiz)
 	/* illegal fd */
 	return;
 
@@ -444,10 +661,11 @@ int tesc_enq_wq (chn_t *ch, msg_t *m)
 int fd = ch->fd;
 struct fdio *fdio;
 
-    if (fd < 0 || fd >= FDMAPSIZ) {
+    if (fd < 0) {
 	/* illegal fd */
 	return -1;
     }
+    fdmap_grow (fd);					/* may exit */
 
 #ifdef DEBUG
     if (! (ch->flags & CHN_F_WR)) {
@@ -490,6 +708,22 @@ struct fdio *fdio;
 }
 
 
+/*
+ *	tesc_wq_empty()
+ *
+ *	returns 1 if nothing is queued for output via 'ch'
+ */
+int tesc_wq_empty (const chn_t *ch)
+{
+int fd = ch->fd;
+
+    if (fd < 0 || fd >= schdat.fdmapsiz || ! schdat.fdio[fd])
+	return 1;
+
+    return ! schdat.fdio[fd]->wq;
+}
+
+
 /*
  *	tesc_del_wq()
  *
@@ -502,7 +736,7 @@ int tesc_del_wq (const chn_t *ch)
 int fd = ch->fd;
 msg_t *cur, *nxt;
 
-    if (fd < 0 || fd >= FDMAPSIZ) {
+    if (fd < 0 || fd >= schdat.fdmapsiz) {
 	/* illegal fd */
 	return -1;
     }
@@ -516,7 +750,7 @@ msg_t *cur, *nxt;
     cur = schdat.fdio[fd]->wq;
     while (cur) {
 	nxt = cur->next;
-	free (cur);
+	data_free_msg (cur);
 	cur = nxt;
     }
 
@@ -630,6 +864,29 @@ struct teqi *ne, **ipos;
 }
 
 
+/*
+ *	tesc_untimedev()
+ *
+ *	remove a scheduled event from the queue
+ *
+ *	returns 0 on success, -1 if not scheduled
+ */
+int tesc_untimedev (const timedev_t *evnt)
+{
+struct teqi *te, **ipos;
+
+    for (ipos = &schdat.teq; *ipos; ipos = &(*ipos)->next)
+	if ((*ipos)->evnt == evnt) {
+	    te = *ipos;
+	    *ipos = te->next;
+	    free (te);
+	    return 0;
+	}
+
+    return -1;
+}
+
+
 /*
  *	tesc_log()
  *
@@ -637,9 +894,8 @@ struct teqi *ne, **ipos;
  *	prepend extra prefix to denote whether this
  *	was read from or written to the channel
  *
- *	no timeouts / no nonblocking writes - we assume
- *	that (in normal operation) we do not block
- *	on disk writes
+ *	the data is only queued, the log writer thread
+ *	does the actual write (see logw.c)
  */
 void tesc_log (msg_t *m, chn_t *ch, int dir)
 {
@@ -650,10 +906,10 @@ struct iovec iov[2];
     iov[0].iov_base = (char*) (dir == LOG_DIR_IN ? pin : pout);
     iov[0].iov_len = (dir == LOG_DIR_IN ? sizeof(pin) : sizeof(pout)) - 1;
 
-    iov[1].iov_base = (m->flags & MF_PLAIN ? m->data : m->prefix);
+    iov[1].iov_base = MSG_HEAD(m);
     iov[1].iov_len = m->len;
 
-    if (writev (ch->log, iov, 2) == -1) {
+    if (logw_write (ch->log, iov, 2) == -1) {
 	/* huh, record error so it can be handled in mlpx_update() */
 	ch->flags |= CHN_ERR_L;
 	ch->e_log = errno;
@@ -674,11 +930,9 @@ void tesc_main ()
 int i, r, l;
 struct pollfd *fds = 0;
 int nfds = 0;
+int npoll;
 struct fdiodli *cur;
 struct fdio *fdio;
-char *cp;
-msg_t *m;
-int dlen;
 struct teqi *te;
 timedev_t *evnt;
 struct timeval now;
@@ -730,7 +984,7 @@ orn_t orn;
 	    if (cur->fdio->ch->flags & CHN_F_IP)
 		fds[i].events |= POLLIN | POLLOUT;
 	    else {
-	      if (cur->fdio->rf)
+	      if (cur->fdio->rf && !cur->fdio->ch->hold)
 		fds[i].events |= POLLIN;
 	      if (cur->fdio->wq) {
 		fds[i].events |= POLLOUT;
@@ -759,6 +1013,15 @@ orn_t orn;
 		 * in the timed event section below			*/
 	      }
 	    }
+
+	    /*
+	     * nothing to wait for (e.g. input on hold): leave it out,
+	     * a hangup is always reported and would make poll() return
+	     * at once, over and over, until the hold is lifted
+	     */
+	    if (! fds[i].events)
+		fds[i].fd = -1;
+
 	    cur = cur->next;
 	}
 
@@ -796,8 +1059,12 @@ orn_t orn;
 	 *	2 -- poll()
 	 */
 
-	r = poll (fds, schdat.numact, ptimo);
+	npoll = schdat.numact;
+	r = poll (fds, npoll, ptimo);
 	if (r == -1) {
+	    if (errno == EINTR)
+		continue;	/* signal (e.g. SIGCHLD), start over */
+
 	    /* poll() failed */
 	    tesc_emerg (CHN_MSG, MF_ERR, "poll(): %s\n", strerror(errno));
 	    tesc_emerg (CHN_MSG, 0, "ptimo = %d\n", ptimo);
@@ -840,13 +1107,17 @@ orn_t orn;
 	 *	4 -- perform the resp. actions for all reported events
 	 */
 
-	for (i = 0; i < schdat.numact; ++i) {
+	/*
+	 * fdios may be added / removed by timed events and in
+	 * here (e.g. async open results), so stick to the ones
+	 * we polled and skip those which are gone
+	 */
+	for (i = 0; i < npoll; ++i) {
+	    if (fds[i].fd == -1)
+		continue;		/* not polled */
 	    fdio = schdat.fdio[fds[i].fd];
-#ifdef DEBUG
-	    if (fdio->ch->fd != fds[i].fd)
-		/* fd mismatch! */
-		exit (1);
-#endif
+	    if (! fdio || fdio->ch->fd != fds[i].fd)
+		continue;
 	    rev = fds[i].revents;
 
 	    if (rev & (POLLERR|POLLHUP|POLLNVAL)) {
@@ -894,48 +1165,25 @@ orn_t orn;
 		}
 	    } /* if POLLIN */
 
-	    if (rev & POLLOUT) { /* write possible */
+	    if ((rev & POLLOUT) && (fdio->wq->flags & MF_SPLICE)) {
+		/* data is in the link pipe of the source channel */
+		if (splice_out (fds[i].fd, fdio) == -1) {
+		    fdio->ch->e_wr = errno;
+		    fdio->ch->flags |= CHN_ERR_W;
+		} else if (fdio->ch->timeout)
+		    fdio->ts = now;
 
-		dlen = fdio->wq->len - fdio->bw;
-		if (fdio->wq->flags & MF_PLAIN)
-		    cp = fdio->wq->data + fdio->bw;
-		else
-		    cp = fdio->wq->prefix + fdio->bw;
-		
-		l = write (fds[i].fd, cp, dlen);
-		if (l == -1) {
+	    } else if (rev & POLLOUT) { /* write possible */
+
+		if ((l = write_out (fds[i].fd, fdio)) == -1) {
 		    /* write failed */
 		    /* and no, can/must not be EAGAIN (we poll()ed) */
 		    fdio->ch->e_wr = errno;
 		    fdio->ch->flags |= CHN_ERR_W;
-		} else {
-
-		    /* we actually got something out ... */
-		    if (fdio->ch->timeout) {
-			/* ... and stall-detection is enabled */
-
-			/* -> update timestamp for this fdio */
-			fdio->ts = now;		/* should be new enough */
-		    }
-
-		    /* bookkeeping, cleanup, logging */
-		    if (l == dlen) {
-			/* head of queue completely out ... */ 
-			m = fdio->wq;
-
-			if (fdio->ch->log != -1)
-			    /* ... log this one */
-			    tesc_log (m, fdio->ch, LOG_DIR_OUT);
-
-			/* ... remove it */
-			fdio->wq = m->next;
-			free (m);
-			fdio->bw = 0;	/* reset */
-			if (!fdio->wq)
-			    fdio->wt = 0;
-		    } else {
-			fdio->bw += l;
-		    }
+		} else if (l && fdio->ch->timeout) {
+		    /* we actually got something out and stall-detection */
+		    /* is enabled -> update timestamp for this fdio */
+		    fdio->ts = now;		/* should be new enough */
 		}
 	    } /* if POLLOUT */
 
@@ -982,6 +1230,8 @@ int i;
 
     /* initialize our private data */
 
+    schdat.fdio = sec_malloc (FDMAPSIZ * sizeof(*schdat.fdio)); /* may exit */
+    schdat.fdmapsiz = FDMAPSIZ;
     for (i = 0; i < FDMAPSIZ; ++i)
 	schdat.fdio[i] = 0;
 
@@ -53,7 +53,9 @@ extern int tesc_del_reader (const chn_t *);
 extern void tesc_keep (const chn_t *);
 extern int tesc_enq_wq (chn_t *, msg_t*);
 extern int tesc_del_wq (const chn_t *);
+extern int tesc_wq_empty (const chn_t *);
 extern int tesc_timedev (timedev_t *);
+extern int tesc_untimedev (const timedev_t *);
 extern void tesc_log (msg_t *, chn_t *, int);
 extern void tesc_main ();
 extern void tesc_init (const struct config *cf);